@@ -0,0 +1,130 @@
+// Counts heap allocations made by fillScene once the scene buffer has been set up. The node is
+// fed mocap poses for a number of rigid bodies, a base pose and joint states from a background
+// thread, then fillScene is called in a loop with a counting operator new. Only allocations on
+// the calling thread are counted, the spinner threads receiving messages allocate by design.
+//
+// Needs a running roscore, exits with 1 if fillScene allocated in steady state.
+// usage: rosrun MuJoCo_realRobot_ROS fillScene_benchmark [objects] [iterations]
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MuJoCo_node.h"
+
+static std::atomic<uint64_t> allocations(0);
+static thread_local bool countAllocations = false;
+
+void* operator new(std::size_t size){
+    if(countAllocations){
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void *p = std::malloc(size == 0 ? 1 : size);
+    if(p == NULL){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept{
+    std::free(p);
+}
+
+// Calls fill iterations times after a short warm up, prints allocations and time per call
+template<typename Fill>
+static uint64_t measure(const char *name, int iterations, Fill fill){
+    for(int i = 0; i < 10; i++){
+        fill();
+    }
+
+    allocations = 0;
+    countAllocations = true;
+    const auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; i++){
+        fill();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    countAllocations = false;
+
+    const uint64_t counted = allocations.load();
+    const double perCall_us = std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+    std::cout << name << ": " << (double)counted / iterations << " allocations per call, "
+              << perCall_us << " us per call" << std::endl;
+    return counted;
+}
+
+int main(int argc, char **argv){
+    int numObjects = 8;
+    int iterations = 100000;
+    if(argc > 1 && std::atoi(argv[1]) > 0){
+        numObjects = std::atoi(argv[1]);
+    }
+    if(argc > 2 && std::atoi(argv[2]) > 0){
+        iterations = std::atoi(argv[2]);
+    }
+
+    std::vector<std::string> objectNames;
+    for(int i = 0; i < numObjects; i++){
+        objectNames.push_back("benchmark_object_" + std::to_string(i));
+    }
+    const robotConfig config;
+    MuJoCo_realRobot_ROS *node = new MuJoCo_realRobot_ROS(argc, argv, std::vector<robotConfig>(1, config), objectNames);
+
+    // Everything the scene reads is kept fresh so no object goes stale during the run
+    ros::NodeHandle nh;
+    std::vector<ros::Publisher> objectPubs;
+    for(const std::string &name : objectNames){
+        objectPubs.push_back(nh.advertise<geometry_msgs::PoseStamped>("/mocap/rigid_bodies/" + name + "/pose", 1));
+    }
+    ros::Publisher basePub = nh.advertise<geometry_msgs::PoseStamped>("/mocap/rigid_bodies/" + config.baseRigidBody + "/pose", 1);
+    ros::Publisher jointPub = nh.advertise<sensor_msgs::JointState>(config.jointStatesTopic, 1);
+
+    std::atomic<bool> publishing(true);
+    std::thread publisher([&](){
+        geometry_msgs::PoseStamped pose;
+        pose.pose.orientation.w = 1.0;
+        sensor_msgs::JointState joints;
+        joints.name = config.jointNames;
+        joints.position.resize(NUM_JOINTS, 0.0);
+        joints.velocity.resize(NUM_JOINTS, 0.0);
+        ros::Rate rate(240.0);
+        while(publishing && ros::ok()){
+            pose.header.stamp = ros::Time::now();
+            for(ros::Publisher &pub : objectPubs){
+                pub.publish(pose);
+            }
+            basePub.publish(pose);
+            joints.header.stamp = pose.header.stamp;
+            jointPub.publish(joints);
+            rate.sleep();
+        }
+    });
+
+    readinessState readiness;
+    if(!node->waitUntilReady(10.0, &readiness)){
+        std::cout << "scene not ready after 10 s, is roscore running?" << std::endl;
+    }
+
+    sceneState world;
+    uint64_t total = measure("fillScene(latest)", iterations, [&](){
+        node->fillScene(world);
+    });
+    total += measure("fillScene(sampleTime)", iterations, [&](){
+        node->fillScene(world, ros::Time::now() - ros::Duration(0.01));
+    });
+
+    publishing = false;
+    publisher.join();
+    delete node;
+
+    return total == 0 ? 0 : 1;
+}
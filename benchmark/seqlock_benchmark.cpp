@@ -0,0 +1,177 @@
+// Contention benchmark for SeqLock, one writer publishing a joint sized snapshot as fast as it
+// can while N readers copy it out. Every field of a write holds the same counter value, so a
+// reader that ever sees two different values got a torn read. The same run with a mutex around
+// a plain struct is printed alongside for comparison.
+//
+// usage: seqlock_benchmark [readers] [seconds]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "SeqLock.h"
+
+// Same size as the node's joint snapshot (q, dq, ddq and two stamps)
+struct benchmarkSnapshot{
+    double q[7];
+    double dq[7];
+    double ddq[7];
+    int64_t q_stamp_ns;
+    int64_t dq_stamp_ns;
+};
+
+static void fillSnapshot(benchmarkSnapshot &snapshot, uint64_t value){
+    for(int i = 0; i < 7; i++){
+        snapshot.q[i] = (double)value;
+        snapshot.dq[i] = (double)value;
+        snapshot.ddq[i] = (double)value;
+    }
+    snapshot.q_stamp_ns = (int64_t)value;
+    snapshot.dq_stamp_ns = (int64_t)value;
+}
+
+static bool consistent(const benchmarkSnapshot &snapshot){
+    const double value = snapshot.q[0];
+    for(int i = 0; i < 7; i++){
+        if(snapshot.q[i] != value || snapshot.dq[i] != value || snapshot.ddq[i] != value){
+            return false;
+        }
+    }
+    return snapshot.q_stamp_ns == (int64_t)value && snapshot.dq_stamp_ns == (int64_t)value;
+}
+
+struct readerResult{
+    uint64_t reads = 0;
+    uint64_t retries = 0;
+    uint64_t torn = 0;
+};
+
+static void report(const char *name, double seconds, uint64_t writes, const std::vector<readerResult> &results){
+    uint64_t reads = 0, retries = 0, torn = 0;
+    for(const readerResult &result : results){
+        reads += result.reads;
+        retries += result.retries;
+        torn += result.torn;
+    }
+    std::cout << name << ": " << writes / seconds / 1e6 << " M writes/s, "
+              << reads / seconds / 1e6 << " M reads/s over " << results.size() << " readers";
+    if(retries > 0){
+        std::cout << ", " << 100.0 * retries / (reads + retries) << " % of read attempts retried";
+    }
+    std::cout << ", " << torn << " torn reads" << std::endl;
+}
+
+static uint64_t runSeqLock(int numReaders, double seconds, std::vector<readerResult> &results){
+    SeqLock<benchmarkSnapshot> lock;
+    std::atomic<bool> running(true);
+    results.assign(numReaders, readerResult());
+
+    std::vector<std::thread> readers;
+    for(int r = 0; r < numReaders; r++){
+        readers.emplace_back([&, r](){
+            readerResult result;
+            benchmarkSnapshot snapshot;
+            while(running.load(std::memory_order_relaxed)){
+                if(!lock.tryRead(snapshot)){
+                    result.retries++;
+                    continue;
+                }
+                result.reads++;
+                if(!consistent(snapshot)){
+                    result.torn++;
+                }
+            }
+            results[r] = result;
+        });
+    }
+
+    uint64_t writes = 0;
+    benchmarkSnapshot snapshot;
+    const auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    while(std::chrono::steady_clock::now() < end){
+        for(int i = 0; i < 1000; i++){
+            fillSnapshot(snapshot, ++writes);
+            lock.write(snapshot);
+        }
+    }
+    running = false;
+    for(std::thread &reader : readers){
+        reader.join();
+    }
+    return writes;
+}
+
+static uint64_t runMutex(int numReaders, double seconds, std::vector<readerResult> &results){
+    std::mutex mutex;
+    benchmarkSnapshot shared;
+    fillSnapshot(shared, 0);
+    std::atomic<bool> running(true);
+    results.assign(numReaders, readerResult());
+
+    std::vector<std::thread> readers;
+    for(int r = 0; r < numReaders; r++){
+        readers.emplace_back([&, r](){
+            readerResult result;
+            benchmarkSnapshot snapshot;
+            while(running.load(std::memory_order_relaxed)){
+                {
+                    std::lock_guard<std::mutex> guard(mutex);
+                    snapshot = shared;
+                }
+                result.reads++;
+                if(!consistent(snapshot)){
+                    result.torn++;
+                }
+            }
+            results[r] = result;
+        });
+    }
+
+    uint64_t writes = 0;
+    benchmarkSnapshot snapshot;
+    const auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    while(std::chrono::steady_clock::now() < end){
+        for(int i = 0; i < 1000; i++){
+            fillSnapshot(snapshot, ++writes);
+            std::lock_guard<std::mutex> guard(mutex);
+            shared = snapshot;
+        }
+    }
+    running = false;
+    for(std::thread &reader : readers){
+        reader.join();
+    }
+    return writes;
+}
+
+int main(int argc, char **argv){
+    // Leave a core for the writer by default
+    int numReaders = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    double seconds = 2.0;
+    if(argc > 1){
+        numReaders = std::max(1, std::atoi(argv[1]));
+    }
+    if(argc > 2){
+        seconds = std::atof(argv[2]);
+    }
+
+    std::vector<readerResult> results;
+    const uint64_t seqLockWrites = runSeqLock(numReaders, seconds, results);
+    report("seqlock", seconds, seqLockWrites, results);
+
+    uint64_t torn = 0;
+    for(const readerResult &result : results){
+        torn += result.torn;
+    }
+
+    const uint64_t mutexWrites = runMutex(numReaders, seconds, results);
+    report("mutex  ", seconds, mutexWrites, results);
+
+    return torn == 0 ? 0 : 1;
+}
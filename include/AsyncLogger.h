@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define LOG_RECORD_VALUES       7
+
+enum logRecordType{
+    LOG_TORQUE_COMMAND = 0,
+    LOG_POSITION_COMMAND,
+    LOG_VELOCITY_COMMAND,
+    // safety records: values[0] = value that went over the limit, values[1] = the limit
+    LOG_SAFETY_VELOCITY,
+    LOG_SAFETY_POSITION,
+    LOG_SAFETY_TORQUE,
+    LOG_SAFETY_ACCELERATION,
+    NUM_LOG_RECORD_TYPES
+};
+
+// Fixed size binary record, this is all the hot path ever writes
+struct logRecord{
+    int64_t time_ns;
+    int32_t type;
+    // robot the record refers to
+    int32_t robot;
+    // joint the record refers to, -1 if it applies to all joints
+    int32_t joint;
+    double values[LOG_RECORD_VALUES];
+};
+
+// Logger for the command and safety hot paths. log() only copies a record into a lock free
+// ring buffer and never blocks, allocates or touches I/O. A background thread formats the
+// records into a file and prints a once per second summary to the terminal.
+// If the ring buffer is full the record is dropped and counted.
+class AsyncLogger{
+    public:
+        explicit AsyncLogger(int capacity = 8192);
+        ~AsyncLogger();
+
+        AsyncLogger(const AsyncLogger&) = delete;
+        AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+        // Opens the log file and starts the writer thread
+        bool start(const std::string &filePath);
+        void stop();
+
+        // Safe to call from any number of threads
+        void log(int type, int joint, const double *values, int numValues, int robot = 0);
+
+    private:
+        struct cell{
+            std::atomic<uint64_t> sequence;
+            logRecord record;
+        };
+
+        bool push(const logRecord &record);
+        bool pop(logRecord &record);
+
+        void run();
+        void writeRecord(const logRecord &record);
+        void printSummary();
+
+        std::vector<cell> buffer;
+        uint64_t bufferMask;
+
+        alignas(64) std::atomic<uint64_t> enqueuePos;
+        alignas(64) uint64_t dequeuePos;
+        alignas(64) std::atomic<uint64_t> droppedRecords;
+
+        FILE *logFile;
+        std::thread writerThread;
+        std::atomic<bool> running;
+
+        // Only touched by the writer thread, reset after every summary
+        uint64_t recordCounts[NUM_LOG_RECORD_TYPES];
+        uint64_t droppedReported;
+        bool haveSafetyRecord;
+        logRecord lastSafetyRecord;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ros/ros.h"
+#include "controller_manager_msgs/SwitchController.h"
+#include "controller_manager_msgs/LoadController.h"
+#include "controller_manager_msgs/ListControllers.h"
+
+// Talks to the ros_control controller manager over persistent service connections and keeps a
+// cached view of which controllers are loaded and running. All service calls happen on one
+// worker thread, so switching never blocks the caller and switches are applied in order.
+class ControllerManagerClient{
+    public:
+        ControllerManagerClient(ros::NodeHandle *nodeHandle, const std::string &managerNamespace = "/controller_manager");
+        ~ControllerManagerClient();
+
+        ControllerManagerClient(const ControllerManagerClient&) = delete;
+        ControllerManagerClient& operator=(const ControllerManagerClient&) = delete;
+
+        // Starts controllerName, loading it first if needed and stopping whatever running
+        // controllers claim the same resources. Returns immediately, the future becomes true
+        // once the controller is running. If it is already known to be running and no other
+        // switch is pending the future is ready straight away.
+        std::shared_future<bool> switchController(const std::string &controllerName);
+
+        // Snapshot of the cached controller state
+        std::vector<std::string> runningControllers();
+        std::vector<std::string> loadedControllers();
+
+    private:
+        struct switchRequest{
+            std::string controllerName;
+            std::promise<bool> result;
+        };
+
+        void run();
+        bool performSwitch(const std::string &controllerName);
+        bool refreshControllers();
+        template<typename T>
+        bool callService(ros::ServiceClient &client, const std::string &service, T &srv);
+
+        ros::NodeHandle *n;
+        std::string loadService;
+        std::string switchService;
+        std::string listService;
+
+        // Only used from the worker thread
+        ros::ServiceClient loadClient;
+        ros::ServiceClient switchClient;
+        ros::ServiceClient listClient;
+        // resources claimed by each controller, from the last list_controllers call
+        std::vector<controller_manager_msgs::ControllerState> controllerStates;
+
+        // Cached view, readable from any thread
+        std::mutex cacheMutex;
+        bool cacheValid;
+        std::set<std::string> loaded;
+        std::set<std::string> running;
+
+        std::mutex queueMutex;
+        std::condition_variable queueCondition;
+        std::deque<switchRequest> requests;
+        // A request has been taken off the queue but not finished yet
+        bool switchInProgress;
+        bool stopWorker;
+        std::thread worker;
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+enum frameOutputFormat{
+    // every frame appended to one file of raw RGB24, rows bottom up as read from OpenGL
+    FRAME_OUTPUT_RAW = 0,
+    // one binary PPM per frame, the output path holds one frame number conversion such as
+    // frame_%06d.ppm (%d with optional zero padding and width, %% for a literal %)
+    FRAME_OUTPUT_PPM,
+    // piped to ffmpeg, the output path decides the encoding (video.mp4, frame_%06d.png, ...)
+    FRAME_OUTPUT_FFMPEG
+};
+
+// Saves rendered frames without ever holding up the renderer. Pixels are read straight into
+// one of a ring of preallocated frames, and a worker thread writes the handed over frames out.
+// If the worker falls behind, new frames are dropped and counted rather than waited for.
+// beginFrame/commitFrame must always be called from the same thread.
+class FrameRecorder{
+    public:
+        FrameRecorder(int width, int height, int capacity = 8);
+        ~FrameRecorder();
+
+        FrameRecorder(const FrameRecorder&) = delete;
+        FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+        // Opens the output and starts the writer thread
+        bool start(const std::string &outputPath, frameOutputFormat outputFormat, double fps);
+        void stop();
+
+        // Free frame of width * height * 3 bytes to read RGB pixels into, NULL if every frame
+        // is still waiting to be written (the frame is dropped)
+        unsigned char* beginFrame();
+        // Hands the frame from the last successful beginFrame over to the writer
+        void commitFrame();
+
+        int getWidth() const { return width; }
+        int getHeight() const { return height; }
+        uint64_t droppedFrames() const { return dropped.load(std::memory_order_relaxed); }
+
+    private:
+        void run();
+        void writeFrame(const unsigned char *pixels);
+        // Splits a PPM output path around its frame number, false if it is not a valid pattern
+        bool parseFramePattern(const std::string &pattern);
+        bool spawnFfmpeg(double fps);
+
+        int width;
+        int height;
+        int capacity;
+        std::vector<std::vector<unsigned char>> frames;
+
+        // Frames handed over by the renderer and frames written out, both only ever increase
+        alignas(64) std::atomic<uint64_t> committed;
+        alignas(64) std::atomic<uint64_t> written;
+        std::atomic<uint64_t> dropped;
+
+        frameOutputFormat format;
+        std::string path;
+        FILE *output;
+        // ffmpeg, when frames are piped to it
+        pid_t encoderPid;
+        // PPM file names are framePrefix, the frame number padded to frameDigits, frameSuffix
+        std::string framePrefix;
+        std::string frameSuffix;
+        int frameDigits;
+        bool frameZeroPad;
+        uint64_t frameIndex;
+        // Top down copy of a frame for formats that need it, writer thread only
+        std::vector<unsigned char> flipped;
+
+        std::thread writerThread;
+        std::atomic<bool> running;
+};
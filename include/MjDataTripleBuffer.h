@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "mujoco.h"
+
+// Hands complete mjData snapshots from one producer thread to one consumer thread without
+// either ever waiting on the other. The producer copies its state into writeBuffer() and
+// publishes it, the consumer acquires the newest published snapshot. With three buffers there is
+// always one free for the producer, so a slow consumer only ever skips snapshots.
+class MjDataTripleBuffer{
+    public:
+        explicit MjDataTripleBuffer(const mjModel *m);
+        ~MjDataTripleBuffer();
+
+        MjDataTripleBuffer(const MjDataTripleBuffer&) = delete;
+        MjDataTripleBuffer& operator=(const MjDataTripleBuffer&) = delete;
+
+        // Producer only. Copies src into the free buffer and makes it the newest snapshot.
+        void publish(const mjData *src);
+
+        // Consumer only. Newest published snapshot, stays untouched by the producer until the
+        // next call. isNew is set to whether it changed since the last call.
+        const mjData* acquire(bool *isNew = NULL);
+
+    private:
+        // Index of the buffer waiting in the middle, with FRESH_BIT set if the consumer has
+        // not picked it up yet
+        static constexpr uint32_t FRESH_BIT = 4;
+        static constexpr uint32_t INDEX_MASK = 3;
+
+        const mjModel *model;
+        mjData *buffers[3];
+        alignas(64) std::atomic<uint32_t> middle;
+        // Owned by the producer and consumer respectively
+        alignas(64) int writeIndex;
+        alignas(64) int readIndex;
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ros/ros.h"
+#include <Eigen/Dense>
+
+struct mocapFilterParams{
+    // One-Euro filter parameters for position (m) and orientation (quaternion components).
+    // minCutoff (Hz) sets the smoothing when still, beta how quickly it opens up with speed.
+    double positionMinCutoff = 1.0;
+    double positionBeta = 5.0;
+    double rotationMinCutoff = 1.0;
+    double rotationBeta = 1.0;
+    // cutoff (Hz) of the low pass filter on the speed estimate driving the adaptive cutoff
+    double derivativeCutoff = 1.0;
+};
+
+// One-Euro filter for many tracked bodies at once. Every body's state is held in columns of
+// struct-of-arrays matrices, so one update() filters all bodies with a handful of Eigen
+// expressions instead of per-body scalar code.
+// The bank grows as bodies are added, so update() only does work for bodies that exist.
+// Measurements, resizes and updates must come from the same thread.
+class MocapFilterBank{
+    public:
+        MocapFilterBank(int numBodies, const mocapFilterParams &params);
+
+        int size() const { return numBodies; }
+
+        // Adds columns for new bodies, existing bodies keep their filter state
+        void resize(int newNumBodies);
+
+        // Stores a raw {x, y, z, w, wx, wy, wz} measurement to be filtered at the next update.
+        // Only the newest measurement per body is filtered, one that replaces a measurement still
+        // waiting is counted in dropped().
+        void setMeasurement(int body, const double pose[7], const ros::Time &stamp);
+        uint64_t dropped() const { return droppedSamples; }
+
+        // Filters every body with a new measurement since the last update, returns how many
+        int update();
+
+        // True if the body got a new filtered pose in the last update
+        bool updated(int body) const { return updatedMask(body) != 0.0; }
+        void filteredPose(int body, double pose[7]) const;
+        const ros::Time& measurementStamp(int body) const { return stamps[body]; }
+
+    private:
+        int numBodies;
+        mocapFilterParams params;
+
+        // Raw measurements waiting to be filtered, one column per body
+        Eigen::Matrix<double, 3, Eigen::Dynamic> rawPosition;
+        Eigen::Matrix<double, 4, Eigen::Dynamic> rawQuat;
+        Eigen::ArrayXd rawTime;
+        // 1 for bodies with a measurement waiting, 0 otherwise
+        Eigen::ArrayXd pendingMask;
+        Eigen::ArrayXd updatedMask;
+        std::vector<ros::Time> stamps;
+
+        // Filter state, one column per body
+        Eigen::ArrayXd initialised;
+        Eigen::ArrayXd lastTime;
+        Eigen::Matrix<double, 3, Eigen::Dynamic> position;
+        Eigen::Matrix<double, 3, Eigen::Dynamic> positionRate;
+        Eigen::Matrix<double, 4, Eigen::Dynamic> quat;
+        Eigen::Matrix<double, 4, Eigen::Dynamic> quatRate;
+
+        uint64_t droppedSamples;
+
+        // Scratch for update(), sized by resize() so filtering does not allocate
+        Eigen::ArrayXd firstSample;
+        Eigen::ArrayXd active;
+        Eigen::ArrayXd dt;
+        Eigen::ArrayXd inverseDt;
+        Eigen::ArrayXd hemisphere;
+        Eigen::ArrayXd derivativeAlpha;
+        Eigen::ArrayXd alpha;
+        Eigen::Matrix<double, 4, Eigen::Dynamic> alignedQuat;
+        Eigen::Matrix<double, 3, Eigen::Dynamic> positionRateRaw;
+        Eigen::Matrix<double, 4, Eigen::Dynamic> quatRateRaw;
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "mujoco.h"
+
+#define MODEL_CACHE_MAX_ENTRIES     16
+
+// Loads an MJCF model, reusing a previously compiled binary copy when nothing it depends on has
+// changed. The cache key is an FNV-1a hash of the MuJoCo version, the XML, every included file
+// and every file referenced by any file* attribute (meshes, textures including cube and skybox
+// faces, height fields, skins), so editing any of them
+// forces a recompile. Binaries are kept in $XDG_CACHE_HOME/MuJoCo_realRobot_ROS, falling back
+// to ~/.cache/MuJoCo_realRobot_ROS. Every edit of the model makes a new binary, only the
+// MODEL_CACHE_MAX_ENTRIES most recently used ones are kept.
+//
+// If the dependencies can not all be read, or the cache is unusable, this just behaves like
+// mj_loadXML. Returns NULL with error filled in if the model does not compile.
+mjModel* loadModelCached(const std::string &xmlPath, char *error, int errorSize, bool useCache = true);
+
+// Every file the model depends on: the XML, its includes, then the referenced assets. Returns
+// false if the XML or one of its includes can not be read.
+bool listModelFiles(const std::string &xmlPath, std::vector<std::string> &files);
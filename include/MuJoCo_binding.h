@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+
+#include "mujoco.h"
+#include "MuJoCo_node.h"
+
+// Table mapping everything tracked in the real scene to where it lives in mjData::qpos.
+// Built once after the model is loaded (and again only if the tracked scene changes shape),
+// so writing the real state into MuJoCo each frame is a straight copy with no name lookups.
+struct mujocoBindingTable{
+    // qpos address of every robot joint, robots stored one after the other, -1 if not in the model
+    std::vector<int> robotQposAdr;
+    // number of joints of each robot, indexes into robotQposAdr
+    std::vector<int> robotJointCount;
+
+    // qpos address of the free joint of every tracked object, -1 if the object is not in the model
+    std::vector<int> objectQposAdr;
+    // qvel address of the free joint, only valid where objectQposAdr is
+    std::vector<int> objectDofAdr;
+    std::vector<int> objectBodyId;
+};
+
+// Resolves every robot joint and tracked object in the scene against the model
+void buildBindingTable(const mjModel *m, const sceneState &world, mujocoBindingTable &table);
+
+// True if the table was built for a scene with the same robots and objects
+bool bindingTableMatches(const mujocoBindingTable &table, const sceneState &world);
+
+// Copies the real scene into qpos and qvel using the precomputed addresses
+void applyBindingTable(const mujocoBindingTable &table, const sceneState &world, mjData *d);
@@ -1,22 +1,28 @@
 #pragma once
 
 // General Includes
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <limits>
 #include <string>
 #include <iostream>
+#include <stdexcept>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 // ROS includes
 #include "ros/ros.h"
+#include <ros/callback_queue.h>
+#include <ros/spinner.h>
 #include <sensor_msgs/JointState.h>
 #include <tf/transform_listener.h>
 #include "std_msgs/Float64MultiArray.h"
 #include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/PoseArray.h>
 #include <franka_msgs/FrankaState.h>
-// Controller includes work straight away when including ROS, nothing needed extra in the cmake
-#include "controller_manager_msgs/SwitchController.h"
-#include "controller_manager_msgs/LoadController.h"
 
 // MuJoCo Simulator
 //#include "mujoco.h"
@@ -27,6 +33,15 @@
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
 
+#include "SeqLock.h"
+#include "PoseHistory.h"
+#include "MocapFilterBank.h"
+#include "RealTimeLoop.h"
+#include "AsyncLogger.h"
+#include "SafetyMonitor.h"
+// Controller includes work straight away when including ROS, nothing needed extra in the cmake
+#include "ControllerManagerClient.h"
+
 
 using namespace Eigen;
 
@@ -38,23 +53,156 @@ typedef Eigen::Matrix<double, 7, 1> m_pose_quat;
 #define NUM_JOINTS          7
 #define PI                  3.14159265359
 #define OPTITRACK           1
+// Upper bound on tracked objects, lets per call scratch matrices live on the stack
+#define MAX_TRACKED_OBJECTS 256
 
-struct objectTracking{
-    std::string parent_id;
-    std::string target_id;
-    std::string mujoco_name;
-};
+static_assert(jointArray::RowsAtCompileTime == NUM_JOINTS, "safety monitor joint count must match the robot");
 
 struct robot_real{
+    // index of the robot, stable for the lifetime of the node
+    int id = -1;
     std::string name;
     std::vector<double> joint_positions;
 };
 
 struct object_real{
+    // index of the tracked object, stable for the lifetime of the node
+    int id = -1;
     std::string name;
     double positions[3];
     // x, y ,z, w
     double quaternion[4];
+    // world frame velocities, m/s and rad/s
+    double linearVelocity[3];
+    double angularVelocity[3];
+    // seconds since the last mocap message for this object arrived, infinite if never seen
+    double age;
+    // false once the object has not been heard from within the stale timeout
+    bool valid;
+    // stale and left for the simulator to move (STALE_SIMULATE), the binding does not write it
+    bool simulated;
+};
+
+// How the per body mocap topics are combined into frames, set with the ~mocap_sync parameter
+enum mocapSyncMode{
+    // every pose is applied as soon as it arrives
+    MOCAP_SYNC_NONE = 0,
+    // poses with identical stamps are applied together
+    MOCAP_SYNC_EXACT,
+    // poses within ~mocap_sync_tolerance seconds of each other are applied together
+    MOCAP_SYNC_APPROXIMATE
+};
+
+// What to do with an object whose mocap stream has gone stale, e.g. because it is occluded
+enum staleObjectPolicy{
+    // keep the last pose, with zero velocity
+    STALE_HOLD = 0,
+    // carry on at the last estimated velocity for up to the prediction horizon, then hold
+    STALE_PREDICT,
+    // stop writing it into MuJoCo so the simulation takes over
+    STALE_SIMULATE
+};
+
+// Arrival statistics of one mocap topic
+struct mocapTopicStats{
+    uint64_t received;
+    // messages missing according to gaps in header.seq
+    uint64_t dropped;
+    // smoothed arrival rate
+    double rate_hz;
+    // seconds since the last message, infinite if none yet
+    double age;
+};
+
+// Which of the inputs the scene needs have arrived, see waitUntilReady
+struct readinessState{
+    // every robot has published a joint state
+    bool jointStates;
+    // the base pose has been seen, and averaged and frozen if freeze_robot_base is set
+    bool robotBase;
+    // rigid bodies given to the constructor that have not been seen yet, discovered bodies
+    // are never required
+    std::vector<std::string> missingObjects;
+
+    bool ready() const { return jointStates && robotBase && missingObjects.empty(); }
+};
+
+// Publishers on one joint_states topic remembered per robot, e.g. an arm, its gripper and a
+// second arm. Beyond this the least recently seen one is resolved again.
+#define JOINT_STATE_SOURCES 4
+
+// Where each robot joint is in the JointState messages of one publisher
+struct jointStateSource{
+    // Connection header of the publisher, held so its address can not be reused by another.
+    // Empty for an unused entry.
+    boost::shared_ptr<ros::M_string> connection;
+    // A publisher is assumed to keep its joint order, a different name count resolves it again
+    int nameCount = 0;
+    // Index into JointState::position of every robot joint, -1 if the publisher does not have it
+    int index[NUM_JOINTS];
+    // How many of this robot's joints the index found
+    int jointsFound = 0;
+    uint64_t lastUsed = 0;
+};
+
+// Latest known state of the robot joints, written by the ROS callbacks and read from anywhere
+struct jointStateSnapshot{
+    double q[NUM_JOINTS];
+    double dq[NUM_JOINTS];
+    // filtered estimate from consecutive dq values
+    double ddq[NUM_JOINTS];
+    // header stamps of the messages q and dq came from
+    ros::Time q_stamp;
+    ros::Time dq_stamp;
+};
+
+// Everything that differs between robots, given to the constructor. Defaults are the single Panda
+// setup, for more than one arm every topic needs to point into that arm's namespace.
+struct robotConfig{
+    std::string name = "panda";
+    std::string jointStatesTopic = "joint_states";
+    std::string frankaStatesTopic = "/franka_state_controller/franka_states";
+    std::string torqueCommandTopic = "/effort_group_effort_controller/command";
+    std::string positionCommandTopic = "/effort_group_position_controller/command";
+    std::string velocityCommandTopic = "/effort_velocity_controller/command";
+    std::string controllerManagerNamespace = "/controller_manager";
+    // applied on top of ~safety_limits_file (config/safety_limits.yaml unless set), empty uses that alone
+    std::string safetyLimitsFile;
+    // Names of the robot's joints in the JointState messages, in robot joint order
+    std::vector<std::string> jointNames = {"panda_joint1", "panda_joint2", "panda_joint3", "panda_joint4",
+                                           "panda_joint5", "panda_joint6", "panda_joint7"};
+    // Calibration, subtracted from the measured joint positions to give the MuJoCo ones
+    jointArray jointOffsets = (jointArray() << 0.0, 0.0, 0.0, 0.0, 0.0, PI/2, PI/4).finished();
+    // OptiTrack rigid body on the robot's base. Only the first robot's base is tracked, it is the
+    // frame every object is expressed in. The other robots sit where the model places them
+    // relative to it.
+    std::string baseRigidBody = "pandaRobot";
+};
+
+enum commandType{
+    COMMAND_NONE = 0,
+    COMMAND_TORQUE,
+    COMMAND_POSITION,
+    COMMAND_VELOCITY
+};
+
+// Latest command submitted by the user, handed to the command thread through a SeqLock
+struct robotCommand{
+    int type;
+    double values[NUM_JOINTS];
+    // steady clock time the command was submitted, nanoseconds
+    int64_t submitTime_ns;
+};
+
+// OptiTrack world frame -> MuJoCo world frame (robot base at the origin), combining the inverse of
+// the robot base pose with the y-up to z-up axis change. Column major.
+struct robotBaseTransform{
+    // applied to positions, linear and angular velocities
+    double rotation[9];
+    double translation[3];
+    // 4x4 matrix taking an OptiTrack orientation {w, x, y, z} to the MuJoCo one, the product of
+    // the left and right quaternion multiplications so it is a single matrix multiply
+    double quatTransform[16];
 };
 
 struct sceneState{
@@ -64,74 +212,297 @@ struct sceneState{
 
 class MuJoCo_realRobot_ROS{
     public:
-        // Constructor
+        // Constructor, a single robot with the default robotConfig
         MuJoCo_realRobot_ROS(int argc, char **argv, std::vector<std::string> optitrack_topic_names);
+        // One robot per config, robot ids are the indices into robotConfigs
+        MuJoCo_realRobot_ROS(int argc, char **argv, const std::vector<robotConfig> &robotConfigs, std::vector<std::string> optitrack_topic_names);
         ~MuJoCo_realRobot_ROS();
 
         // -----------------------------------------------------------------------------------
-        // ROS subscribers
-        ros::Subscriber jointStates_sub;
-        void jointStates_callback(const sensor_msgs::JointState &msg);
-
-        ros::Subscriber frankaStates_sub;
-        void frankaStates_callback(const franka_msgs::FrankaState &msg);
+        // ROS subscribers, robotId is bound into the robot callbacks when subscribing
+        void jointStates_callback(const ros::MessageEvent<sensor_msgs::JointState const> &event, int robotId);
+        void frankaStates_callback(const franka_msgs::FrankaState::ConstPtr &msg, int robotId);
 
         std::vector<ros::Subscriber> optiTrack_sub;
-        void optiTrack_callback(const geometry_msgs::PoseStamped::ConstPtr &msg, const std::string& topic_name);
+        // objectId is resolved when subscribing and bound into the callback
+        void optiTrack_callback(const geometry_msgs::PoseStamped::ConstPtr &msg, int objectId);
+
+        // Alternative to the per body topics when the driver publishes one geometry_msgs/PoseArray
+        // per frame (~mocap_array_topic), bodies ordered as ~mocap_array_bodies
+        ros::Subscriber mocapArray_sub;
+        void mocapArray_callback(const geometry_msgs::PoseArray::ConstPtr &msg);
 
         ros::Subscriber robotBase_sub;
+        // Keeps the cached base transform up to date. The base is static, so once a batch of
+        // poses agrees to within robot_base_tolerance their average is frozen and the
+        // subscription is dropped.
         void robotBasePose_callback(const geometry_msgs::PoseStamped &msg);
         // -----------------------------------------------------------------------------------
 
         // Return a struct representing the state of the scene
         sceneState returnScene();
-
-        bool switchController(std::string controllerName);
+        // Same as returnScene but writes into a caller owned scene. Names, ids and storage are only
+        // set up the first time a buffer is passed in, so reusing the same buffer every frame
+        // does not allocate.
+        void fillScene(sceneState &world);
+        // Samples every tracked object at the same instant, interpolating between the stamped
+        // mocap poses either side of sampleTime. A zero sampleTime uses the latest poses.
+        void fillScene(sceneState &world, const ros::Time &sampleTime);
+
+        // Periodically looks through the advertised /mocap/rigid_bodies/<name>/pose topics and
+        // starts tracking any whose name matches one of modelBodyNames, as well as dropping
+        // the subscriptions of discovered bodies that stop being advertised. Objects keep their
+        // index for the lifetime of the node, fillScene grows the object list as they appear.
+        void enableMocapDiscovery(const std::vector<std::string> &modelBodyNames, double scanPeriod_s = 1.0);
+
+        int numberOfRobots();
+
+        // Non blocking, the future becomes true once the controller is running
+        std::shared_future<bool> switchController(std::string controllerName);
+        std::shared_future<bool> switchController(int robotId, std::string controllerName);
+        // Without a robotId commands go to the first robot
         void sendTorquesToRealRobot(double torques[]);
         void sendPositionsToRealRobot(double positions[]);
         void sendVelocitiesToRealRobot(double velocities[]);
-
+        void sendTorquesToRealRobot(int robotId, const double torques[]);
+        void sendPositionsToRealRobot(int robotId, const double positions[]);
+        void sendVelocitiesToRealRobot(int robotId, const double velocities[]);
+
+        // When enabled the joint positions returned by fillScene are predicted forward from the
+        // last received state to the requested sample time (or now, if none is given) using
+        // q + dq*dt + 0.5*ddq*dt^2. dt is clamped to +-maxHorizon_s. Every robot is predicted to
+        // the same instant, so arms with independent state streams line up in the scene.
+        void setJointExtrapolation(bool enabled, double maxHorizon_s = 0.1);
+
+        // Smooth the mocap poses of every tracked object with a One-Euro filter before they reach
+        // the pose history. All objects are filtered together rate_hz times a second.
+        void enableMocapFilter(const mocapFilterParams &params, double rate_hz = 240.0);
+
+        // True once the robot base pose has been averaged and frozen
+        bool isRobotBaseFrozen();
+
+        readinessState getReadiness();
+        // Blocks until every robot has a joint state, the base pose is known and every rigid body
+        // given to the constructor has been seen, or until timeout_s has passed. Returns whether
+        // everything arrived, state (if given) says what is still missing.
+        bool waitUntilReady(double timeout_s, readinessState *state = NULL);
+
+        // Objects not heard from for longer than timeout_s are marked invalid and handled by
+        // policy. STALE_PREDICT extrapolates for at most predictHorizon_s.
+        void setStaleObjectPolicy(staleObjectPolicy policy, double timeout_s = 0.1, double predictHorizon_s = 0.25);
+        mocapTopicStats getMocapStats(int objectId);
+
+        // Window over which object velocities are estimated from the pose history, longer is
+        // smoother but lags more
+        void setObjectVelocityWindow(double window_s);
+
+        // Safety monitor state, a halt is latched until resetTorqueControl() is called.
+        // isHalted() is true if any robot is halted, resetTorqueControl() resets them all.
+        bool isHalted();
+        bool isHalted(int robotId);
+        safetyEvent getSafetyEvent(int robotId = 0);
         void resetTorqueControl();
 
-        bool jointsCallBackCalled;
-        bool objectCallBackCalled;
+        // Publish commands from a dedicated fixed rate thread rather than from the caller. Once
+        // started, the send*ToRealRobot functions only hand the command over and return, the
+        // thread republishes the latest command every cycle. If no new command arrives within
+        // commandTimeout_s torque and velocity commands fall back to zero, position commands
+        // stop being published so the controller holds the last target.
+        // The send functions must then all be called from the same thread.
+        void startCommandThread(const realTimeLoopConfig &config, double commandTimeout_s = 0.05);
+        void stopCommandThread();
+        realTimeLoopStats getCommandThreadStats();
+
+        std::atomic<bool> jointsCallBackCalled;
+        std::atomic<bool> objectCallBackCalled;
 
     private:
 
-        int numberOfObjects;
+        // Objects [0, numberOfObjects) are fully set up, storage below is reserved up front for
+        // MAX_TRACKED_OBJECTS so it never reallocates while being read
+        std::atomic<int> numberOfObjects;
         std::vector<std::string> optitrack_objects;
-        std::vector<bool> optitrack_objects_found;
-
-        std::vector<objectTracking> objectTrackingList;
-        std::vector<m_pose_quat> objectPoseList;
-        std::vector<m_point> objectPosOffsetList;
-
+        // Objects [0, requiredObjects) were asked for by name and have to be seen to be ready
+        int requiredObjects;
+        std::unordered_map<std::string, int> optitrack_object_ids;
+        std::vector<std::atomic<bool>> optitrack_objects_found;
+
+        // Arrival bookkeeping per mocap topic, written by the mocap thread
+        struct mocapTopicState{
+            std::atomic<int64_t> lastArrival_ns{0};
+            std::atomic<uint64_t> received{0};
+            std::atomic<uint64_t> dropped{0};
+            std::atomic<double> rate_hz{0.0};
+            uint32_t lastSeq = 0;
+        };
+        std::vector<mocapTopicState> objectTopicState;
+
+        // Mocap frame assembly, all on the mocap thread. A frame is applied once every subscribed
+        // body has a pose for it, when a pose from a later frame arrives, or mocapFrameTimeout
+        // after its first pose arrived, so an occluded body never holds up the others.
+        int mocapSync;
+        double mocapSyncTolerance;
+        std::string mocapArrayTopic;
+        std::vector<int> mocapArrayObjectIds;
+        // Changed by discovery on its own thread
+        std::atomic<int> subscribedObjects;
+        ros::Time pendingFrameStamp;
+        Matrix<double, 7, Dynamic> pendingFramePoses;
+        std::vector<ros::Time> pendingFrameStamps;
+        std::vector<int> pendingFrameObjects;
+        std::vector<bool> pendingFramePresent;
+        double mocapFrameTimeout;
+        std::chrono::steady_clock::time_point pendingFrameArrival;
+        ros::Timer mocapFrameTimer;
+        void mocapFrameTimeout_callback(const ros::TimerEvent &event);
+        bool sameMocapFrame(const ros::Time &a, const ros::Time &b);
+        void addToMocapFrame(int objectId, const double pose[7], const ros::Time &stamp);
+        void flushMocapFrame();
+
+        // Odd while a group of poses is being written, fillScene retries if it changes under it
+        // so it never mixes objects from different frames
+        std::atomic<uint32_t> mocapFrameSequence;
+        void beginMocapFrame();
+        void endMocapFrame();
+
+        // Hands a raw pose to the filter or straight to the pose history
+        void storePose(int objectId, const double pose[7], const ros::Time &stamp);
+        void recordArrival(int objectId, uint32_t seq);
+
+        std::atomic<int> stalePolicy;
+        std::atomic<double> staleTimeout;
+        std::atomic<double> stalePredictHorizon;
+
+        // Recent stamped poses of every object, written by the mocap callbacks and read by
+        // returnScene from any thread
+        std::vector<std::unique_ptr<PoseHistory>> objectPoseHistory;
+
+        // Robot base pose in the OptiTrack frame {x, y, z, w, wx, wy, wz}, averaged once frozen
         m_pose_quat robotBase;
+        // Written by the base callback, read every time the scene is filled
+        SeqLock<robotBaseTransform> baseTransform;
+        void updateBaseTransform(const m_pose_quat &basePose);
+
+        // Base averaging, only touched by the mocap thread
+        bool freezeRobotBase;
+        int baseAverageSamples;
+        double baseTolerance;
+        double baseAngleTolerance;
+        int baseSampleCount;
+        m_point basePositionSum;
+        m_quat baseQuatSum;
+        m_point baseMin;
+        m_point baseMax;
+        double baseMaxAngle;
+        std::atomic<bool> robotBaseFrozen;
+        std::atomic<bool> robotBaseReceived;
 
         ros::NodeHandle *n;
         tf::TransformListener *listener;
 
-        // Different publishers for different controllers
-        ros::Publisher *torque_pub;
-        ros::Publisher *position_pub;
-        ros::Publisher *velocity_pub;
+        // Callback processing, robot state and mocap each have their own queue and spinner
+        // thread so a slow consumer in one group cannot starve another. Controller manager
+        // services are called from each ControllerManagerClient's own worker thread.
+        ros::CallbackQueue stateQueue;
+        ros::CallbackQueue mocapQueue;
+        ros::NodeHandle *stateNh;
+        ros::NodeHandle *mocapNh;
+        ros::AsyncSpinner *stateSpinner;
+        ros::AsyncSpinner *mocapSpinner;
+        // Discovery asks the master for its topics, a blocking XML-RPC call, so it gets a thread
+        // of its own rather than holding up the mocap callbacks
+        ros::CallbackQueue discoveryQueue;
+        ros::NodeHandle *discoveryNh;
+        ros::AsyncSpinner *discoverySpinner;
+
+        // Everything owned by one robot, set up in the constructor and never resized after
+        struct robotInterface{
+            robotConfig config;
+
+            ros::Subscriber jointStates_sub;
+            ros::Subscriber frankaStates_sub;
+
+            // Joint order of each publisher on the joint_states topic, resolved by name from its
+            // first message. Later messages are matched to their publisher by connection, so
+            // arms and grippers sharing the topic each keep their own index and the steady
+            // state gather never looks at the names.
+            jointStateSource jointStateSources[JOINT_STATE_SOURCES];
+            uint64_t jointStateMessages;
+
+            // Different publishers for different controllers
+            ros::Publisher torque_pub;
+            ros::Publisher position_pub;
+            ros::Publisher velocity_pub;
+            // Messages are allocated once and reused for every command
+            std_msgs::Float64MultiArray torqueMsg;
+            std_msgs::Float64MultiArray positionMsg;
+            std_msgs::Float64MultiArray velocityMsg;
+
+            ControllerManagerClient *controllerManager;
+
+            // Latest command, read by the command thread
+            SeqLock<robotCommand> commandMailbox;
+
+            // Runs on every franka_states message
+            SafetyMonitor safetyMonitor;
+
+            // Joint state shared between the callbacks (writer) and the API functions (readers).
+            // Both state callbacks are served by the state thread, the seqlock only supports a
+            // single writer.
+            SeqLock<jointStateSnapshot> jointState;
+            // Writer side copy, only ever touched by the callbacks
+            jointStateSnapshot latestJointState;
+            std::atomic<bool> jointStateReceived;
+        };
+        std::vector<std::unique_ptr<robotInterface>> robotInterfaces;
+        void setupRobot(int robotId, const robotConfig &config, const std::string &defaultSafetyLimitsFile);
+        const jointStateSource& findJointStateSource(robotInterface &robot, const boost::shared_ptr<ros::M_string> &connection, const sensor_msgs::JointState &msg);
+        void buildJointStateIndex(robotInterface &robot, jointStateSource &source, const sensor_msgs::JointState &msg);
+
+        // Command thread, every cycle publishes the latest command of every robot
+        RealTimeLoop commandLoop;
+        int64_t commandTimeout_ns;
+        void submitCommand(int robotId, int type, const double values[]);
+        void commandCycle();
+
+        void publishTorques(int robotId, const double torques[]);
+        void publishPositions(int robotId, const double positions[]);
+        void publishVelocities(int robotId, const double velocities[]);
+
+        // Hot path logging, records are formatted and written by a background thread
+        AsyncLogger commandLogger;
+
+        // Index of a tracked object from its optitrack name, -1 if it is not tracked
+        int getObjectId(const std::string &itemName);
+        // Sets up storage for a new object, -1 if there is no room. Constructor or mocap thread only.
+        int addObject(const std::string &name);
+        void subscribeObject(int objectId);
+
+        // Runtime discovery of mocap bodies, all on the discovery thread. New objects and their
+        // subscriptions are set up there, their pose callbacks then run on the mocap thread.
+        std::unordered_set<std::string> discoveryBodyNames;
+        std::vector<bool> objectDiscovered;
+        ros::Timer discoveryTimer;
+        void mocapDiscovery_callback(const ros::TimerEvent &event);
 
-        std::string currentController;
+        // Updates the joint states of the robot
+        void fillRobotState(std::vector<robot_real> &robots, const ros::Time &sampleTime);
 
-        int getObjectId(std::string itemName);
+        std::atomic<double> objectVelocityWindow;
 
-        // Updates the joint states of the robot
-        std::vector<robot_real> returnRobotState();
+        std::atomic<bool> extrapolateJoints;
+        std::atomic<double> extrapolationHorizon;
         // Loops through all known objects in the scene and updates their position and rotation
-        std::vector<object_real> returnObjectsStates();
-//        m_pose_quat filterObjectHistory(std::vector<m_pose_quat> objectPoses);
+        void fillObjectsStates(std::vector<object_real> &objects, const ros::Time &sampleTime);
 
-        // Sets the qpos value for the corresponding body id to the specified value
+        // Raw mocap poses are collected here and filtered in one pass per timer tick, both run
+        // on the mocap thread
+        MocapFilterBank *mocapFilter;
+        std::atomic<bool> mocapFilterEnabled;
+        ros::Timer mocapFilterTimer;
+        void mocapFilter_callback(const ros::TimerEvent &event);
 
+        // Sets the qpos value for the corresponding body id to the specified value
 
-        double jointVals[7];
-        double jointSpeeds[7];
 
-        bool haltRobot = false;
-        
 };
\ No newline at end of file
@@ -0,0 +1,11 @@
+#pragma once
+
+// OpenGL context without a visible window, for rendering on machines with no display. Which
+// implementation is used is chosen at build time with the RENDER_BACKEND cmake option:
+//  EGL    - surfaceless EGL context, works with a GPU driver or Mesa's software EGL. The default,
+//           falls back to a hidden GLFW window if EGL can not be initialised
+//  OSMESA - OSMesa software rendering, needs neither a display nor a GPU
+//  GLFW   - hidden GLFW window, needs a display (X server or similar) but no extra libraries
+// MuJoCo renders into its own offscreen framebuffer, so the context itself has no useful size.
+bool createOffscreenGLContext(int width, int height);
+void destroyOffscreenGLContext();
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "ros/ros.h"
+#include <Eigen/Dense>
+
+#include "SeqLock.h"
+
+// Pose of a tracked object as received from the mocap system, same layout as m_pose_quat
+// {x, y, z, w, wx, wy, wz}, with the stamp of the message it came from
+struct stampedPose{
+    double pose[7];
+    ros::Time stamp;
+    // position of this entry in the history, used to spot slots overwritten while reading
+    uint64_t index;
+};
+
+// Fixed capacity ring buffer of the most recent stamped poses of one tracked body.
+// One thread adds poses, any number of threads can query it without locking.
+class PoseHistory{
+    public:
+        explicit PoseHistory(int capacity = 64);
+
+        PoseHistory(const PoseHistory&) = delete;
+        PoseHistory& operator=(const PoseHistory&) = delete;
+
+        // Stamps are expected to be non decreasing, only ever call from one thread
+        void add(const double pose[7], const ros::Time &stamp);
+
+        // Number of poses received so far (not limited by the capacity)
+        uint64_t count() const { return written.load(std::memory_order_acquire); }
+
+        // Most recent pose, returns false if nothing has been received yet
+        bool latest(stampedPose &out) const;
+
+        // Pose at time t, position interpolated linearly and orientation with slerp between the
+        // two poses either side of t. Times after the newest pose return the newest pose, times
+        // before the oldest pose still held return the oldest. Returns false if empty.
+        bool poseAt(const ros::Time &t, double pose[7]) const;
+
+        // Linear and angular (world frame, rad/s) velocity at time t, from the difference between
+        // the poses at t and t - window. Differencing across a window rather than consecutive
+        // samples keeps mocap noise from being amplified. A zero t uses the newest pose. Both
+        // ends are clamped to the history held, and the difference is divided by the time
+        // actually between them. Returns false if there is not enough history yet.
+        bool velocityAt(const ros::Time &t, double window_s, double linear[3], double angular[3]) const;
+
+    private:
+        // poseAt, also giving the time the pose is actually for once t is clamped to the history
+        bool sampleAt(const ros::Time &t, double pose[7], ros::Time &sampleTime) const;
+
+        // Reads the entry with the given index, false if it has already been overwritten
+        bool readEntry(uint64_t index, stampedPose &entry) const;
+
+        int capacity;
+        std::unique_ptr<SeqLock<stampedPose>[]> slots;
+        std::atomic<uint64_t> written;
+};
+
+// Interpolates between two poses in {x, y, z, w, wx, wy, wz} layout, alpha 0 gives from
+void interpolatePose(const double from[7], const double to[7], double alpha, double result[7]);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "SeqLock.h"
+
+struct realTimeLoopConfig{
+    // rate the cycle function is called at
+    double rate_hz = 1000.0;
+    // SCHED_FIFO priority (1 - 99), 0 leaves the thread with the default scheduler
+    int priority = 80;
+    // CPU the thread is pinned to, -1 lets the scheduler decide
+    int cpu = -1;
+    // lock all current and future pages of the process into memory to avoid page faults
+    bool lockMemory = true;
+};
+
+// Timing of the loop since it was started, periods are measured between consecutive wake ups
+struct realTimeLoopStats{
+    uint64_t cycles;
+    // cycles that ran past their deadline, the loop resynchronises after each one
+    uint64_t overruns;
+    double minPeriod_us;
+    double maxPeriod_us;
+    double meanPeriod_us;
+    double p99Period_us;
+};
+
+// Calls a function at a fixed rate on a dedicated thread, optionally with real time priority.
+// Sleeps on absolute deadlines so the period does not drift with the time the cycle takes.
+class RealTimeLoop{
+    public:
+        RealTimeLoop();
+        ~RealTimeLoop();
+
+        RealTimeLoop(const RealTimeLoop&) = delete;
+        RealTimeLoop& operator=(const RealTimeLoop&) = delete;
+
+        // Starts the loop thread, returns false if it is already running
+        bool start(const realTimeLoopConfig &loopConfig, std::function<void()> cycleFunction);
+        void stop();
+        bool isRunning() const;
+
+        // Safe to call from any thread while the loop is running
+        realTimeLoopStats getStats() const;
+
+    private:
+        void run();
+        void setupThread();
+        void recordPeriod(double period_us);
+        void publishStats();
+
+        realTimeLoopConfig config;
+        std::function<void()> cycle;
+
+        std::thread loopThread;
+        std::atomic<bool> running;
+
+        // Histogram of periods in 1 us bins, anything longer goes in the last bin.
+        // Only touched by the loop thread, allocated before it starts.
+        static constexpr int HISTOGRAM_BINS = 10000;
+        std::vector<uint32_t> periodHistogram;
+        realTimeLoopStats loopStats;
+        double periodSum_us;
+
+        SeqLock<realTimeLoopStats> sharedStats;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+#include "ros/ros.h"
+#include <Eigen/Dense>
+
+#include "SeqLock.h"
+
+// One value per joint of the arm
+typedef Eigen::Array<double, 7, 1> jointArray;
+
+enum safetyReason{
+    SAFETY_OK = 0,
+    SAFETY_VELOCITY,
+    SAFETY_POSITION,
+    SAFETY_TORQUE,
+    SAFETY_ACCELERATION
+};
+
+struct safetyLimits{
+    jointArray maxVelocity;
+    jointArray minPosition;
+    jointArray maxPosition;
+    jointArray maxTorque;
+    jointArray maxAcceleration;
+    double accelerationFilterAlpha;
+};
+
+// What caused the monitor to halt the robot
+struct safetyEvent{
+    int reason;
+    int joint;
+    // value that went over the limit and the limit it was checked against
+    double value;
+    double limit;
+    ros::Time stamp;
+};
+
+// Checks every robot state message against velocity, position, torque and acceleration limits,
+// all joints at once. The first violation latches a halt that stays until reset() is called.
+// update() must only be called from one thread, everything else is safe from any thread.
+// There are no built in limits, until loadLimits() succeeds any motion halts the robot.
+// config/safety_limits.yaml holds the limits for the Franka Emika Panda.
+class SafetyMonitor{
+    public:
+        SafetyMonitor();
+
+        // Loads limits from a yaml file, any limit missing from the file keeps its current value.
+        // Returns false and keeps the current limits if the file cannot be read.
+        bool loadLimits(const std::string &filePath);
+        const safetyLimits& getLimits() const { return limits; }
+
+        // Returns true if this update latched a new halt
+        bool update(const jointArray &q, const jointArray &dq, const jointArray &tau, const ros::Time &stamp);
+
+        // Low pass filtered joint accelerations from the velocities seen by update(),
+        // only valid on the thread that calls update()
+        const jointArray& accelerationEstimate() const { return filteredAcceleration; }
+
+        bool isHalted() const { return halted.load(std::memory_order_acquire); }
+        safetyEvent lastEvent() const { return haltEvent.read(); }
+        void reset();
+
+    private:
+        void latch(int reason, const jointArray &values, const jointArray &exceeded, const jointArray &limit, const ros::Time &stamp);
+
+        safetyLimits limits;
+
+        // Acceleration estimate from consecutive velocities, only touched by update()
+        bool havePrevious;
+        jointArray previousDq;
+        jointArray filteredAcceleration;
+        ros::Time previousStamp;
+
+        std::atomic<bool> halted;
+        SeqLock<safetyEvent> haltEvent;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Tells the core we are busy waiting, frees pipeline resources for a hyperthread sibling and
+// avoids the memory order mis-speculation penalty when the awaited store lands
+inline void cpuRelax(){
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Single writer / multiple reader sequence lock.
+//
+// The writer never blocks and never waits on readers. Readers copy the payload out and retry if
+// the writer touched it while they were reading, so a reader can never observe a half written
+// value. The payload is stored as relaxed atomic words so the copy itself is not a data race.
+//
+// Only ONE thread may call write() on a given SeqLock. Any number of threads may call read().
+template<typename T>
+class SeqLock{
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock payload must be trivially copyable");
+
+    public:
+        SeqLock(){
+            sequence.store(0, std::memory_order_relaxed);
+            for(int i = 0; i < NUM_WORDS; i++){
+                words[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        explicit SeqLock(const T &initial) : SeqLock(){
+            write(initial);
+        }
+
+        SeqLock(const SeqLock&) = delete;
+        SeqLock& operator=(const SeqLock&) = delete;
+
+        void write(const T &value){
+            uint64_t buffer[NUM_WORDS] = {};
+            std::memcpy(buffer, &value, sizeof(T));
+
+            const uint32_t seq = sequence.load(std::memory_order_relaxed);
+            // Odd sequence number marks a write in progress
+            sequence.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            for(int i = 0; i < NUM_WORDS; i++){
+                words[i].store(buffer[i], std::memory_order_relaxed);
+            }
+
+            sequence.store(seq + 2, std::memory_order_release);
+        }
+
+        T read() const{
+            T value;
+            while(!tryRead(value)){
+                // writer is mid update, spin until it finishes
+                cpuRelax();
+            }
+            return value;
+        }
+
+        // Single attempt at a consistent read, returns false if the writer was active
+        bool tryRead(T &value) const{
+            uint64_t buffer[NUM_WORDS];
+
+            const uint32_t seqBefore = sequence.load(std::memory_order_acquire);
+            if(seqBefore & 1){
+                return false;
+            }
+
+            for(int i = 0; i < NUM_WORDS; i++){
+                buffer[i] = words[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint32_t seqAfter = sequence.load(std::memory_order_relaxed);
+            if(seqBefore != seqAfter){
+                return false;
+            }
+
+            std::memcpy(&value, buffer, sizeof(T));
+            return true;
+        }
+
+        // Number of completed writes, useful for readers to detect new data without copying
+        uint32_t version() const{
+            return sequence.load(std::memory_order_acquire) >> 1;
+        }
+
+    private:
+        static constexpr int NUM_WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+        // Keep the sequence counter and payload away from neighbouring data to avoid false sharing
+        alignas(64) std::atomic<uint32_t> sequence;
+        std::atomic<uint64_t> words[NUM_WORDS];
+};
@@ -0,0 +1,218 @@
+#include "AsyncLogger.h"
+
+#include <chrono>
+
+#include "ros/ros.h"
+
+// How long the writer sleeps when there is nothing to write
+#define WRITER_IDLE_MS          2
+#define SUMMARY_PERIOD_S        1.0
+
+static const char *recordTypeNames[NUM_LOG_RECORD_TYPES] = {
+    "torque_cmd", "position_cmd", "velocity_cmd",
+    "safety_velocity", "safety_position", "safety_torque", "safety_acceleration"
+};
+
+static int64_t steadyTime_ns(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+AsyncLogger::AsyncLogger(int capacity){
+    // capacity must be a power of two so positions can be wrapped with a mask
+    uint64_t size = 1;
+    while(size < (uint64_t)capacity){
+        size <<= 1;
+    }
+
+    buffer = std::vector<cell>(size);
+    for(uint64_t i = 0; i < size; i++){
+        buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    bufferMask = size - 1;
+
+    enqueuePos = 0;
+    dequeuePos = 0;
+    droppedRecords = 0;
+
+    logFile = NULL;
+    running = false;
+}
+
+AsyncLogger::~AsyncLogger(){
+    stop();
+}
+
+bool AsyncLogger::start(const std::string &filePath){
+    if(running){
+        return false;
+    }
+
+    logFile = fopen(filePath.c_str(), "w");
+    if(logFile == NULL){
+        ROS_ERROR("could not open log file %s", filePath.c_str());
+        return false;
+    }
+    fprintf(logFile, "# time_s type robot joint values\n");
+
+    for(int i = 0; i < NUM_LOG_RECORD_TYPES; i++){
+        recordCounts[i] = 0;
+    }
+    droppedReported = 0;
+    haveSafetyRecord = false;
+
+    running = true;
+    writerThread = std::thread(&AsyncLogger::run, this);
+    return true;
+}
+
+void AsyncLogger::stop(){
+    running = false;
+    if(writerThread.joinable()){
+        writerThread.join();
+    }
+    if(logFile != NULL){
+        fclose(logFile);
+        logFile = NULL;
+    }
+}
+
+void AsyncLogger::log(int type, int joint, const double *values, int numValues, int robot){
+    logRecord record;
+    record.time_ns = steadyTime_ns();
+    record.type = type;
+    record.robot = robot;
+    record.joint = joint;
+    for(int i = 0; i < LOG_RECORD_VALUES; i++){
+        record.values[i] = i < numValues ? values[i] : 0.0;
+    }
+
+    if(!push(record)){
+        droppedRecords.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Bounded multi producer queue, each cell's sequence number says whether it is free to write
+// (sequence == position) or holds a record ready to read (sequence == position + 1)
+bool AsyncLogger::push(const logRecord &record){
+    uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+    cell *target;
+
+    while(true){
+        target = &buffer[pos & bufferMask];
+        const uint64_t seq = target->sequence.load(std::memory_order_acquire);
+        const int64_t diff = (int64_t)seq - (int64_t)pos;
+        if(diff == 0){
+            if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                break;
+            }
+        }
+        else if(diff < 0){
+            // full
+            return false;
+        }
+        else{
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    target->record = record;
+    target->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+// Only ever called by the writer thread
+bool AsyncLogger::pop(logRecord &record){
+    cell *source = &buffer[dequeuePos & bufferMask];
+    const uint64_t seq = source->sequence.load(std::memory_order_acquire);
+    if((int64_t)seq - (int64_t)(dequeuePos + 1) < 0){
+        // empty
+        return false;
+    }
+
+    record = source->record;
+    source->sequence.store(dequeuePos + bufferMask + 1, std::memory_order_release);
+    dequeuePos++;
+    return true;
+}
+
+void AsyncLogger::run(){
+    int64_t lastSummary_ns = steadyTime_ns();
+    logRecord record;
+
+    while(true){
+        // read running before draining so nothing logged before stop() is lost
+        const bool keepRunning = running;
+
+        bool wroteRecords = false;
+        while(pop(record)){
+            writeRecord(record);
+            wroteRecords = true;
+        }
+
+        const int64_t now_ns = steadyTime_ns();
+        if(now_ns - lastSummary_ns > SUMMARY_PERIOD_S * 1e9){
+            fflush(logFile);
+            printSummary();
+            lastSummary_ns = now_ns;
+        }
+
+        if(!keepRunning){
+            break;
+        }
+        if(!wroteRecords){
+            std::this_thread::sleep_for(std::chrono::milliseconds(WRITER_IDLE_MS));
+        }
+    }
+
+    fflush(logFile);
+    printSummary();
+}
+
+void AsyncLogger::writeRecord(const logRecord &record){
+    fprintf(logFile, "%.6f %s %d %d", record.time_ns / 1e9, recordTypeNames[record.type], record.robot, record.joint);
+    for(int i = 0; i < LOG_RECORD_VALUES; i++){
+        fprintf(logFile, " %g", record.values[i]);
+    }
+    fprintf(logFile, "\n");
+
+    recordCounts[record.type]++;
+    if(record.type >= LOG_SAFETY_VELOCITY){
+        haveSafetyRecord = true;
+        lastSafetyRecord = record;
+    }
+}
+
+void AsyncLogger::printSummary(){
+    const uint64_t dropped = droppedRecords.load(std::memory_order_relaxed);
+    const uint64_t newlyDropped = dropped - droppedReported;
+    droppedReported = dropped;
+
+    uint64_t total = 0;
+    for(int i = 0; i < NUM_LOG_RECORD_TYPES; i++){
+        total += recordCounts[i];
+    }
+    if(total == 0 && newlyDropped == 0){
+        return;
+    }
+
+    std::string summary;
+    char entry[64];
+    for(int i = 0; i < NUM_LOG_RECORD_TYPES; i++){
+        if(recordCounts[i] > 0){
+            snprintf(entry, sizeof(entry), "%s: %lu  ", recordTypeNames[i], (unsigned long)recordCounts[i]);
+            summary += entry;
+        }
+        recordCounts[i] = 0;
+    }
+    if(newlyDropped > 0){
+        snprintf(entry, sizeof(entry), "dropped: %lu", (unsigned long)newlyDropped);
+        summary += entry;
+    }
+    ROS_INFO("last %.0f s - %s", SUMMARY_PERIOD_S, summary.c_str());
+
+    if(haveSafetyRecord){
+        ROS_WARN("%s triggered on robot %d joint %d, value: %f, limit: %f", recordTypeNames[lastSafetyRecord.type],
+                 lastSafetyRecord.robot, lastSafetyRecord.joint, lastSafetyRecord.values[0], lastSafetyRecord.values[1]);
+        haveSafetyRecord = false;
+    }
+}
@@ -0,0 +1,232 @@
+#include "ControllerManagerClient.h"
+
+// How long to wait for the controller manager to appear before a call is given up on
+#define SERVICE_WAIT_S          5.0
+
+ControllerManagerClient::ControllerManagerClient(ros::NodeHandle *nodeHandle, const std::string &managerNamespace){
+    n = nodeHandle;
+    loadService = managerNamespace + "/load_controller";
+    switchService = managerNamespace + "/switch_controller";
+    listService = managerNamespace + "/list_controllers";
+
+    // Persistent connections avoid the service lookup and tcp handshake on every call
+    loadClient = n->serviceClient<controller_manager_msgs::LoadController>(loadService, true);
+    switchClient = n->serviceClient<controller_manager_msgs::SwitchController>(switchService, true);
+    listClient = n->serviceClient<controller_manager_msgs::ListControllers>(listService, true);
+
+    cacheValid = false;
+    stopWorker = false;
+    switchInProgress = false;
+    worker = std::thread(&ControllerManagerClient::run, this);
+}
+
+ControllerManagerClient::~ControllerManagerClient(){
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopWorker = true;
+    }
+    queueCondition.notify_all();
+    worker.join();
+
+    // Anyone still waiting on a switch that never ran gets a failure rather than a broken promise
+    for(int i = 0; i < requests.size(); i++){
+        requests[i].result.set_value(false);
+    }
+}
+
+std::shared_future<bool> ControllerManagerClient::switchController(const std::string &controllerName){
+    switchRequest request;
+    request.controllerName = controllerName;
+    std::shared_future<bool> result = request.result.get_future().share();
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        // The cache only says what will be running once the worker is idle, a queued switch may
+        // still stop this controller, so then the request has to go through the queue in order
+        if(requests.empty() && !switchInProgress){
+            std::lock_guard<std::mutex> cacheLock(cacheMutex);
+            if(cacheValid && running.count(controllerName)){
+                request.result.set_value(true);
+                return result;
+            }
+        }
+        requests.push_back(std::move(request));
+    }
+    queueCondition.notify_one();
+
+    return result;
+}
+
+std::vector<std::string> ControllerManagerClient::runningControllers(){
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return std::vector<std::string>(running.begin(), running.end());
+}
+
+std::vector<std::string> ControllerManagerClient::loadedControllers(){
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return std::vector<std::string>(loaded.begin(), loaded.end());
+}
+
+void ControllerManagerClient::run(){
+    // Query what is loaded and running once up front, so later switches know what to stop
+    refreshControllers();
+
+    while(true){
+        switchRequest request;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCondition.wait(lock, [this]{ return stopWorker || !requests.empty(); });
+            if(stopWorker){
+                return;
+            }
+            request = std::move(requests.front());
+            requests.pop_front();
+            switchInProgress = true;
+        }
+
+        const bool switched = performSwitch(request.controllerName);
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            switchInProgress = false;
+        }
+        request.result.set_value(switched);
+    }
+}
+
+template<typename T>
+bool ControllerManagerClient::callService(ros::ServiceClient &client, const std::string &service, T &srv){
+    if(client.isValid() && client.call(srv)){
+        return true;
+    }
+
+    // Persistent connections do not survive the controller manager restarting, reconnect once
+    if(!ros::service::waitForService(service, ros::Duration(SERVICE_WAIT_S))){
+        ROS_ERROR_STREAM("service " << service << " not available");
+        return false;
+    }
+    client = n->serviceClient<T>(service, true);
+    return client.call(srv);
+}
+
+bool ControllerManagerClient::refreshControllers(){
+    controller_manager_msgs::ListControllers list;
+    if(!callService(listClient, listService, list)){
+        ROS_ERROR_STREAM("could not list controllers");
+        return false;
+    }
+
+    controllerStates = list.response.controller;
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    loaded.clear();
+    running.clear();
+    for(int i = 0; i < controllerStates.size(); i++){
+        loaded.insert(controllerStates[i].name);
+        if(controllerStates[i].state == "running"){
+            running.insert(controllerStates[i].name);
+        }
+    }
+    cacheValid = true;
+    return true;
+}
+
+bool ControllerManagerClient::performSwitch(const std::string &controllerName){
+    bool cacheValidNow;
+    bool isRunning;
+    bool isLoaded;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        cacheValidNow = cacheValid;
+        isRunning = running.count(controllerName) > 0;
+        isLoaded = loaded.count(controllerName) > 0;
+    }
+
+    if(!cacheValidNow){
+        if(!refreshControllers()){
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        isRunning = running.count(controllerName) > 0;
+        isLoaded = loaded.count(controllerName) > 0;
+    }
+
+    if(isRunning){
+        return true;
+    }
+
+    if(!isLoaded){
+        controller_manager_msgs::LoadController load_controller_req;
+        load_controller_req.request.name = controllerName;
+        if(!callService(loadClient, loadService, load_controller_req) || !load_controller_req.response.ok){
+            ROS_ERROR_STREAM("Error occured trying to load controller " << controllerName);
+            return false;
+        }
+        // Need the new controller's claimed resources to know what it conflicts with
+        if(!refreshControllers()){
+            return false;
+        }
+    }
+
+    // Stop every running controller that claims any of the resources the new one needs
+    std::set<std::string> neededResources;
+    for(int i = 0; i < controllerStates.size(); i++){
+        if(controllerStates[i].name != controllerName){
+            continue;
+        }
+        for(int j = 0; j < controllerStates[i].claimed_resources.size(); j++){
+            const std::vector<std::string> &resources = controllerStates[i].claimed_resources[j].resources;
+            neededResources.insert(resources.begin(), resources.end());
+        }
+    }
+
+    std::vector<std::string> stop_controller;
+    for(int i = 0; i < controllerStates.size(); i++){
+        if(controllerStates[i].state != "running" || controllerStates[i].name == controllerName){
+            continue;
+        }
+        bool conflicts = false;
+        for(int j = 0; j < controllerStates[i].claimed_resources.size() && !conflicts; j++){
+            const std::vector<std::string> &resources = controllerStates[i].claimed_resources[j].resources;
+            for(int k = 0; k < resources.size(); k++){
+                if(neededResources.count(resources[k])){
+                    conflicts = true;
+                    break;
+                }
+            }
+        }
+        if(conflicts){
+            stop_controller.push_back(controllerStates[i].name);
+        }
+    }
+
+    controller_manager_msgs::SwitchController switch_controller_req;
+    switch_controller_req.request.start_controllers.push_back(controllerName);
+    switch_controller_req.request.stop_controllers = stop_controller;
+    switch_controller_req.request.strictness = 1;
+    switch_controller_req.request.start_asap = false;
+    if(!callService(switchClient, switchService, switch_controller_req) || !switch_controller_req.response.ok){
+        ROS_ERROR_STREAM("Error occured trying to switch controller");
+        // State is unknown now, query it again before the next switch
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        cacheValid = false;
+        return false;
+    }
+
+    ROS_INFO_STREAM("Controller switch correctly");
+
+    for(int i = 0; i < controllerStates.size(); i++){
+        if(controllerStates[i].name == controllerName){
+            controllerStates[i].state = "running";
+        }
+        for(int j = 0; j < stop_controller.size(); j++){
+            if(controllerStates[i].name == stop_controller[j]){
+                controllerStates[i].state = "stopped";
+            }
+        }
+    }
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    running.insert(controllerName);
+    for(int j = 0; j < stop_controller.size(); j++){
+        running.erase(stop_controller[j]);
+    }
+    return true;
+}
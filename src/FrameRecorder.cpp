@@ -0,0 +1,222 @@
+#include "FrameRecorder.h"
+
+#include <chrono>
+#include <cctype>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ros/ros.h"
+
+#define WRITER_IDLE_MS      2
+
+FrameRecorder::FrameRecorder(int width, int height, int capacity) : width(width), height(height), capacity(capacity){
+    frames.resize(capacity);
+    for(int i = 0; i < capacity; i++){
+        frames[i].resize(width * height * 3);
+    }
+    flipped.resize(width * height * 3);
+
+    committed = 0;
+    written = 0;
+    dropped = 0;
+    output = NULL;
+    encoderPid = -1;
+    frameIndex = 0;
+    running = false;
+}
+
+FrameRecorder::~FrameRecorder(){
+    stop();
+}
+
+bool FrameRecorder::start(const std::string &outputPath, frameOutputFormat outputFormat, double fps){
+    if(running){
+        return false;
+    }
+
+    format = outputFormat;
+    path = outputPath;
+    frameIndex = 0;
+
+    if(format == FRAME_OUTPUT_RAW){
+        output = fopen(path.c_str(), "wb");
+    }
+    else if(format == FRAME_OUTPUT_FFMPEG){
+        spawnFfmpeg(fps);
+    }
+    else if(!parseFramePattern(path)){
+        ROS_ERROR("frame recorder: %s needs exactly one frame number conversion such as %%06d", path.c_str());
+        return false;
+    }
+
+    if(format != FRAME_OUTPUT_PPM && output == NULL){
+        ROS_ERROR("frame recorder: could not open %s", path.c_str());
+        return false;
+    }
+
+    running = true;
+    writerThread = std::thread(&FrameRecorder::run, this);
+    ROS_INFO("frame recorder: writing %dx%d frames to %s", width, height, path.c_str());
+    return true;
+}
+
+void FrameRecorder::stop(){
+    if(!running){
+        return;
+    }
+    running = false;
+    writerThread.join();
+
+    if(output != NULL){
+        // Closing the pipe ends ffmpeg's input, it finishes the file and exits
+        fclose(output);
+    }
+    output = NULL;
+    if(encoderPid > 0){
+        int status;
+        waitpid(encoderPid, &status, 0);
+    }
+    encoderPid = -1;
+    ROS_INFO("frame recorder: %lu frames written, %lu dropped", (unsigned long)frameIndex, (unsigned long)droppedFrames());
+}
+
+bool FrameRecorder::parseFramePattern(const std::string &pattern){
+    framePrefix.clear();
+    frameSuffix.clear();
+    bool found = false;
+
+    for(size_t i = 0; i < pattern.size(); i++){
+        std::string &text = found ? frameSuffix : framePrefix;
+        if(pattern[i] != '%'){
+            text += pattern[i];
+            continue;
+        }
+        if(i + 1 < pattern.size() && pattern[i + 1] == '%'){
+            text += '%';
+            i++;
+            continue;
+        }
+
+        // %[0][width]d
+        if(found){
+            return false;
+        }
+        size_t j = i + 1;
+        frameZeroPad = j < pattern.size() && pattern[j] == '0';
+        if(frameZeroPad){
+            j++;
+        }
+        frameDigits = 0;
+        while(j < pattern.size() && isdigit((unsigned char)pattern[j]) && frameDigits < 100){
+            frameDigits = frameDigits * 10 + (pattern[j] - '0');
+            j++;
+        }
+        if(j >= pattern.size() || pattern[j] != 'd' || frameDigits >= 100){
+            return false;
+        }
+        found = true;
+        i = j;
+    }
+    return found;
+}
+
+bool FrameRecorder::spawnFfmpeg(double fps){
+    // Run directly rather than through a shell, so the path is never interpreted
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) != 0){
+        return false;
+    }
+
+    const std::string size = std::to_string(width) + "x" + std::to_string(height);
+    const std::string rate = std::to_string(fps);
+    // OpenGL rows are bottom up, ffmpeg flips them while encoding
+    const char *argv[] = {"ffmpeg", "-y", "-loglevel", "error", "-f", "rawvideo", "-pix_fmt", "rgb24",
+                          "-s", size.c_str(), "-r", rate.c_str(), "-i", "-", "-vf", "vflip", path.c_str(), NULL};
+
+    // The read end becomes ffmpeg's stdin, everything else is closed on exec
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+    const int result = posix_spawnp(&encoderPid, "ffmpeg", &actions, NULL, const_cast<char* const*>(argv), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[0]);
+
+    if(result != 0){
+        encoderPid = -1;
+        close(fds[1]);
+        return false;
+    }
+    output = fdopen(fds[1], "w");
+    if(output == NULL){
+        close(fds[1]);
+        waitpid(encoderPid, NULL, 0);
+        encoderPid = -1;
+        return false;
+    }
+    return true;
+}
+
+unsigned char* FrameRecorder::beginFrame(){
+    const uint64_t index = committed.load(std::memory_order_relaxed);
+    if(!running || index - written.load(std::memory_order_acquire) >= (uint64_t)capacity){
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+    return frames[index % capacity].data();
+}
+
+void FrameRecorder::commitFrame(){
+    committed.store(committed.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void FrameRecorder::run(){
+    while(true){
+        // read running before draining so every frame committed before stop() is written
+        const bool keepRunning = running;
+
+        bool wroteFrames = false;
+        uint64_t next = written.load(std::memory_order_relaxed);
+        while(next < committed.load(std::memory_order_acquire)){
+            writeFrame(frames[next % capacity].data());
+            next++;
+            written.store(next, std::memory_order_release);
+            wroteFrames = true;
+        }
+
+        if(!keepRunning){
+            break;
+        }
+        if(!wroteFrames){
+            std::this_thread::sleep_for(std::chrono::milliseconds(WRITER_IDLE_MS));
+        }
+    }
+}
+
+void FrameRecorder::writeFrame(const unsigned char *pixels){
+    const size_t rowBytes = width * 3;
+
+    if(format == FRAME_OUTPUT_PPM){
+        char number[128];
+        snprintf(number, sizeof(number), frameZeroPad ? "%0*llu" : "%*llu", frameDigits, (unsigned long long)frameIndex);
+        const std::string fileName = framePrefix + number + frameSuffix;
+        FILE *file = fopen(fileName.c_str(), "wb");
+        if(file == NULL){
+            ROS_WARN_THROTTLE(1.0, "frame recorder: could not open %s", fileName.c_str());
+            return;
+        }
+
+        for(int row = 0; row < height; row++){
+            memcpy(&flipped[row * rowBytes], &pixels[(height - 1 - row) * rowBytes], rowBytes);
+        }
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+        fwrite(flipped.data(), 1, flipped.size(), file);
+        fclose(file);
+    }
+    else{
+        fwrite(pixels, 1, rowBytes * height, output);
+    }
+    frameIndex++;
+}
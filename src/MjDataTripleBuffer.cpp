@@ -0,0 +1,37 @@
+#include "MjDataTripleBuffer.h"
+
+MjDataTripleBuffer::MjDataTripleBuffer(const mjModel *m) : model(m){
+    for(int i = 0; i < 3; i++){
+        buffers[i] = mj_makeData(m);
+    }
+    writeIndex = 0;
+    middle = 1;
+    readIndex = 2;
+}
+
+MjDataTripleBuffer::~MjDataTripleBuffer(){
+    for(int i = 0; i < 3; i++){
+        mj_deleteData(buffers[i]);
+    }
+}
+
+void MjDataTripleBuffer::publish(const mjData *src){
+    mj_copyData(buffers[writeIndex], model, src);
+
+    // Swap the filled buffer into the middle and take whatever was there to write next time
+    const uint32_t previous = middle.exchange(writeIndex | FRESH_BIT, std::memory_order_acq_rel);
+    writeIndex = previous & INDEX_MASK;
+}
+
+const mjData* MjDataTripleBuffer::acquire(bool *isNew){
+    const bool fresh = (middle.load(std::memory_order_relaxed) & FRESH_BIT) != 0;
+    if(fresh){
+        const uint32_t previous = middle.exchange(readIndex, std::memory_order_acq_rel);
+        readIndex = previous & INDEX_MASK;
+    }
+
+    if(isNew != NULL){
+        *isNew = fresh;
+    }
+    return buffers[readIndex];
+}
@@ -0,0 +1,144 @@
+#include "MocapFilterBank.h"
+
+#include <cmath>
+
+// Smallest time step used in the filter, guards against repeated stamps
+#define MIN_FILTER_DT       1e-4
+
+MocapFilterBank::MocapFilterBank(int numBodies, const mocapFilterParams &params) : numBodies(0), params(params), droppedSamples(0){
+    resize(numBodies);
+}
+
+void MocapFilterBank::resize(int newNumBodies){
+    if(newNumBodies <= numBodies){
+        return;
+    }
+    const int added = newNumBodies - numBodies;
+
+    rawPosition.conservativeResize(Eigen::NoChange, newNumBodies);
+    rawQuat.conservativeResize(Eigen::NoChange, newNumBodies);
+    rawTime.conservativeResize(newNumBodies);
+    pendingMask.conservativeResize(newNumBodies);
+    updatedMask.conservativeResize(newNumBodies);
+    stamps.resize(newNumBodies);
+
+    initialised.conservativeResize(newNumBodies);
+    lastTime.conservativeResize(newNumBodies);
+    position.conservativeResize(Eigen::NoChange, newNumBodies);
+    positionRate.conservativeResize(Eigen::NoChange, newNumBodies);
+    quat.conservativeResize(Eigen::NoChange, newNumBodies);
+    quatRate.conservativeResize(Eigen::NoChange, newNumBodies);
+
+    // New bodies start with nothing pending and an identity orientation
+    rawPosition.rightCols(added).setZero();
+    rawQuat.rightCols(added).setZero();
+    rawTime.tail(added).setZero();
+    pendingMask.tail(added).setZero();
+    updatedMask.tail(added).setZero();
+    initialised.tail(added).setZero();
+    lastTime.tail(added).setZero();
+    position.rightCols(added).setZero();
+    positionRate.rightCols(added).setZero();
+    quat.rightCols(added).setZero();
+    quat.rightCols(added).row(0).setOnes();
+    quatRate.rightCols(added).setZero();
+
+    // Scratch for update(), sized here so filtering never allocates
+    firstSample.resize(newNumBodies);
+    active.resize(newNumBodies);
+    dt.resize(newNumBodies);
+    inverseDt.resize(newNumBodies);
+    hemisphere.resize(newNumBodies);
+    derivativeAlpha.resize(newNumBodies);
+    alpha.resize(newNumBodies);
+    alignedQuat.resize(Eigen::NoChange, newNumBodies);
+    positionRateRaw.resize(Eigen::NoChange, newNumBodies);
+    quatRateRaw.resize(Eigen::NoChange, newNumBodies);
+
+    numBodies = newNumBodies;
+}
+
+void MocapFilterBank::setMeasurement(int body, const double pose[7], const ros::Time &stamp){
+    if(pendingMask(body) != 0.0){
+        droppedSamples++;
+    }
+    rawPosition.col(body) << pose[0], pose[1], pose[2];
+    rawQuat.col(body) << pose[3], pose[4], pose[5], pose[6];
+    rawTime(body) = stamp.toSec();
+    stamps[body] = stamp;
+    pendingMask(body) = 1.0;
+}
+
+// Smoothing factor of a first order low pass filter with the given cutoff, per body, written
+// in place: 1 / (1 + tau / dt) with tau = 1 / (2 pi cutoff)
+static void smoothingFactor(Eigen::ArrayXd &alpha, const Eigen::ArrayXd &dt){
+    alpha = (2.0 * M_PI) * alpha * dt;
+    alpha = alpha / (alpha + 1.0);
+}
+
+int MocapFilterBank::update(){
+    updatedMask = pendingMask;
+    const int numUpdated = (int)pendingMask.sum();
+    if(numUpdated == 0){
+        return 0;
+    }
+
+    // Bodies seen for the first time start at their measurement
+    firstSample = pendingMask * (1.0 - initialised);
+    for(int i = 0; i < numBodies; i++){
+        if(firstSample(i) != 0.0){
+            position.col(i) = rawPosition.col(i);
+            quat.col(i) = rawQuat.col(i).normalized();
+            positionRate.col(i).setZero();
+            quatRate.col(i).setZero();
+            lastTime(i) = rawTime(i);
+            initialised(i) = 1.0;
+        }
+    }
+    // Only bodies that already had a state and got a new measurement are filtered below,
+    // everyone else gets a smoothing factor of zero and keeps their state unchanged
+    active = pendingMask - firstSample;
+    dt = (rawTime - lastTime).max(MIN_FILTER_DT);
+    inverseDt = dt.inverse();
+
+    // q and -q are the same rotation, flip measurements onto the same hemisphere as the state
+    // so the filter never averages across the sign flip
+    hemisphere = ((rawQuat.cwiseProduct(quat)).colwise().sum().transpose().array() < 0.0).select(-1.0, Eigen::ArrayXd::Ones(numBodies));
+    alignedQuat.noalias() = rawQuat * hemisphere.matrix().asDiagonal();
+
+    derivativeAlpha.setConstant(params.derivativeCutoff);
+    smoothingFactor(derivativeAlpha, dt);
+    derivativeAlpha *= active;
+
+    // Position
+    positionRateRaw.noalias() = (rawPosition - position) * inverseDt.matrix().asDiagonal();
+    positionRate.noalias() += (positionRateRaw - positionRate) * derivativeAlpha.matrix().asDiagonal();
+    alpha = params.positionMinCutoff + params.positionBeta * positionRate.colwise().norm().transpose().array();
+    smoothingFactor(alpha, dt);
+    alpha *= active;
+    position.noalias() += (rawPosition - position) * alpha.matrix().asDiagonal();
+
+    // Orientation, filtered component wise then renormalised
+    quatRateRaw.noalias() = (alignedQuat - quat) * inverseDt.matrix().asDiagonal();
+    quatRate.noalias() += (quatRateRaw - quatRate) * derivativeAlpha.matrix().asDiagonal();
+    alpha = params.rotationMinCutoff + params.rotationBeta * quatRate.colwise().norm().transpose().array();
+    smoothingFactor(alpha, dt);
+    alpha *= active;
+    quat.noalias() += (alignedQuat - quat) * alpha.matrix().asDiagonal();
+    quat.colwise().normalize();
+
+    lastTime = active.select(rawTime, lastTime);
+    pendingMask.setZero();
+
+    return numUpdated;
+}
+
+void MocapFilterBank::filteredPose(int body, double pose[7]) const{
+    pose[0] = position(0, body);
+    pose[1] = position(1, body);
+    pose[2] = position(2, body);
+    pose[3] = quat(0, body);
+    pose[4] = quat(1, body);
+    pose[5] = quat(2, body);
+    pose[6] = quat(3, body);
+}
@@ -0,0 +1,329 @@
+#include "ModelCache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+#define FNV_OFFSET_BASIS    14695981039346656037ULL
+#define FNV_PRIME           1099511628211ULL
+// Includes can nest, stop if a model somehow includes itself
+#define MAX_INCLUDE_DEPTH   16
+
+static void fnv1a(uint64_t &hash, const void *data, size_t size){
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < size; i++){
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+}
+
+static bool readFile(const fs::path &path, std::string &contents){
+    std::ifstream file(path, std::ios::binary);
+    if(!file){
+        return false;
+    }
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+    return true;
+}
+
+// One start or empty element tag, attribute values as written between the quotes
+struct xmlElement{
+    std::string tag;
+    std::vector<std::pair<std::string, std::string>> attributes;
+};
+
+static bool isNameChar(char c){
+    return std::isalnum((unsigned char)c) || c == '_' || c == ':' || c == '-' || c == '.';
+}
+
+// Every start and empty element tag in document order, comments, declarations and end tags
+// skipped. A plain linear scan: std::regex recurses once per character and overflows the stack
+// on large attribute values (inline meshes, keyframes) or long comments.
+static void scanElements(const std::string &xml, std::vector<xmlElement> &elements){
+    elements.clear();
+    const size_t size = xml.size();
+    size_t i = 0;
+    while((i = xml.find('<', i)) != std::string::npos){
+        // Commented out includes and assets are not dependencies
+        if(xml.compare(i, 4, "<!--") == 0){
+            const size_t commentEnd = xml.find("-->", i + 4);
+            if(commentEnd == std::string::npos){
+                return;
+            }
+            i = commentEnd + 3;
+            continue;
+        }
+
+        i++;
+        const size_t nameStart = i;
+        while(i < size && isNameChar(xml[i])){
+            i++;
+        }
+        if(i == nameStart){
+            // end tag, declaration or processing instruction
+            continue;
+        }
+
+        xmlElement element;
+        element.tag = xml.substr(nameStart, i - nameStart);
+        while(i < size && xml[i] != '>'){
+            if(!isNameChar(xml[i])){
+                i++;
+                continue;
+            }
+
+            const size_t attributeStart = i;
+            while(i < size && isNameChar(xml[i])){
+                i++;
+            }
+            const size_t attributeEnd = i;
+            while(i < size && std::isspace((unsigned char)xml[i])){
+                i++;
+            }
+            if(i >= size || xml[i] != '='){
+                continue;
+            }
+            i++;
+            while(i < size && std::isspace((unsigned char)xml[i])){
+                i++;
+            }
+            // Attribute values may be in double or single quotes
+            if(i >= size || (xml[i] != '"' && xml[i] != '\'')){
+                continue;
+            }
+            const size_t valueEnd = xml.find(xml[i], i + 1);
+            if(valueEnd == std::string::npos){
+                return;
+            }
+            element.attributes.emplace_back(xml.substr(attributeStart, attributeEnd - attributeStart), xml.substr(i + 1, valueEnd - i - 1));
+            i = valueEnd + 1;
+        }
+        elements.push_back(std::move(element));
+    }
+}
+
+// Value of attribute in the first element with that tag, empty if there is none
+static std::string findAttribute(const std::vector<xmlElement> &elements, const std::string &tag, const std::string &attribute){
+    for(const xmlElement &element : elements){
+        if(element.tag != tag){
+            continue;
+        }
+        for(const auto &entry : element.attributes){
+            if(entry.first == attribute){
+                return entry.second;
+            }
+        }
+    }
+    return "";
+}
+
+// Reads xmlPath and every file it includes, in document order. MuJoCo resolves include paths
+// against the directory of the top level model.
+static bool gatherModelFiles(const fs::path &xmlPath, const fs::path &modelDir, int depth,
+                             std::vector<fs::path> &paths, std::vector<std::vector<xmlElement>> &elements){
+    if(depth > MAX_INCLUDE_DEPTH){
+        return false;
+    }
+
+    std::string xml;
+    if(!readFile(xmlPath, xml)){
+        std::cout << "model cache: could not read " << xmlPath << std::endl;
+        return false;
+    }
+    paths.push_back(xmlPath);
+    elements.emplace_back();
+    scanElements(xml, elements.back());
+
+    // Copied, the recursion below grows elements
+    std::vector<fs::path> includes;
+    for(const xmlElement &element : elements.back()){
+        if(element.tag != "include"){
+            continue;
+        }
+        for(const auto &entry : element.attributes){
+            if(entry.first == "file"){
+                includes.push_back(entry.second);
+            }
+        }
+    }
+
+    for(fs::path includePath : includes){
+        if(includePath.is_relative()){
+            includePath = modelDir / includePath;
+        }
+        if(!gatherModelFiles(includePath, modelDir, depth + 1, paths, elements)){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool listModelFiles(const std::string &xmlFile, std::vector<std::string> &files){
+    const fs::path xmlPath = xmlFile;
+    const fs::path modelDir = xmlPath.parent_path();
+    std::vector<fs::path> paths;
+    std::vector<std::vector<xmlElement>> elements;
+    if(!gatherModelFiles(xmlPath, modelDir, 0, paths, elements)){
+        return false;
+    }
+
+    // The compiler element can live in any of the files
+    std::string meshDir, textureDir, assetDir;
+    for(size_t i = 0; i < elements.size(); i++){
+        if(meshDir.empty()) meshDir = findAttribute(elements[i], "compiler", "meshdir");
+        if(textureDir.empty()) textureDir = findAttribute(elements[i], "compiler", "texturedir");
+        if(assetDir.empty()) assetDir = findAttribute(elements[i], "compiler", "assetdir");
+    }
+    if(meshDir.empty()) meshDir = assetDir;
+    if(textureDir.empty()) textureDir = assetDir;
+
+    // Every file attribute of every element, including the six faces of cube and skybox
+    // textures (fileright, fileleft, fileup, filedown, filefront, fileback)
+    std::set<fs::path> assets;
+    files.clear();
+    for(size_t i = 0; i < elements.size(); i++){
+        files.push_back(paths[i].string());
+
+        for(const xmlElement &element : elements[i]){
+            if(element.tag == "include"){
+                continue;
+            }
+
+            for(const auto &entry : element.attributes){
+                if(entry.first.compare(0, 4, "file") != 0 || entry.second.empty()){
+                    continue;
+                }
+                fs::path assetPath = entry.second;
+                if(assetPath.is_relative()){
+                    if(element.tag == "texture"){
+                        assetPath = modelDir / textureDir / assetPath;
+                    }
+                    else if(element.tag == "mesh" || element.tag == "hfield" || element.tag == "skin"){
+                        assetPath = modelDir / meshDir / assetPath;
+                    }
+                    else{
+                        assetPath = modelDir / assetPath;
+                    }
+                }
+                assets.insert(assetPath.lexically_normal());
+            }
+        }
+    }
+
+    // Sorted so the hash does not depend on the order assets are declared in
+    for(const fs::path &assetPath : assets){
+        files.push_back(assetPath.string());
+    }
+    return true;
+}
+
+static bool hashModel(const std::string &xmlPath, uint64_t &hash){
+    std::vector<std::string> files;
+    if(!listModelFiles(xmlPath, files)){
+        return false;
+    }
+
+    hash = FNV_OFFSET_BASIS;
+    const int version = mj_version();
+    fnv1a(hash, &version, sizeof(version));
+
+    // Paths are hashed as well as contents, so pointing at a different file is also a change
+    for(const std::string &file : files){
+        std::string data;
+        if(!readFile(file, data)){
+            std::cout << "model cache: could not read " << file << std::endl;
+            return false;
+        }
+        fnv1a(hash, file.data(), file.size());
+        fnv1a(hash, data.data(), data.size());
+    }
+    return true;
+}
+
+static fs::path cacheDirectory(){
+    const char *xdgCache = std::getenv("XDG_CACHE_HOME");
+    if(xdgCache != NULL && xdgCache[0] != '\0'){
+        return fs::path(xdgCache) / "MuJoCo_realRobot_ROS";
+    }
+    const char *home = std::getenv("HOME");
+    if(home != NULL && home[0] != '\0'){
+        return fs::path(home) / ".cache" / "MuJoCo_realRobot_ROS";
+    }
+    return fs::path();
+}
+
+// Deletes the least recently used binaries beyond MODEL_CACHE_MAX_ENTRIES. Hits refresh the
+// modification time, so the models in use stay and the ones left behind by edits go.
+static void pruneCache(const fs::path &cacheDir){
+    std::error_code ec;
+    std::vector<std::pair<fs::file_time_type, fs::path>> entries;
+    for(fs::directory_iterator it(cacheDir, ec), end; !ec && it != end; it.increment(ec)){
+        if(it->path().extension() == ".mjb"){
+            entries.emplace_back(fs::last_write_time(it->path(), ec), it->path());
+        }
+    }
+    if(entries.size() <= MODEL_CACHE_MAX_ENTRIES){
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b){ return a.first > b.first; });
+    for(size_t i = MODEL_CACHE_MAX_ENTRIES; i < entries.size(); i++){
+        fs::remove(entries[i].second, ec);
+    }
+}
+
+mjModel* loadModelCached(const std::string &xmlPath, char *error, int errorSize, bool useCache){
+    uint64_t hash;
+    const fs::path cacheDir = cacheDirectory();
+    if(!useCache || cacheDir.empty() || !hashModel(xmlPath, hash)){
+        return mj_loadXML(xmlPath.c_str(), NULL, error, errorSize);
+    }
+
+    char hashString[17];
+    snprintf(hashString, sizeof(hashString), "%016llx", (unsigned long long)hash);
+    const fs::path cachePath = cacheDir / (std::string(hashString) + ".mjb");
+
+    std::error_code ec;
+    if(fs::exists(cachePath, ec)){
+        mjModel *m = mj_loadModel(cachePath.c_str(), NULL);
+        if(m != NULL){
+            fs::last_write_time(cachePath, fs::file_time_type::clock::now(), ec);
+            std::cout << "loaded compiled model from cache " << cachePath << std::endl;
+            return m;
+        }
+        // Truncated or otherwise unreadable, recompile and overwrite it
+        std::cout << "model cache: ignoring unreadable " << cachePath << std::endl;
+    }
+
+    mjModel *m = mj_loadXML(xmlPath.c_str(), NULL, error, errorSize);
+    if(m == NULL){
+        return NULL;
+    }
+
+    // Written under a temporary name and renamed, so another process never loads a partial file
+    fs::create_directories(cacheDir, ec);
+    const fs::path tempPath = cacheDir / (std::string(hashString) + ".mjb." + std::to_string(getpid()));
+    mj_saveModel(m, tempPath.c_str(), NULL, 0);
+    fs::rename(tempPath, cachePath, ec);
+    if(ec){
+        std::cout << "model cache: could not write " << cachePath << ", " << ec.message() << std::endl;
+        fs::remove(tempPath, ec);
+    }
+    pruneCache(cacheDir);
+
+    return m;
+}
@@ -0,0 +1,104 @@
+#include "MuJoCo_binding.h"
+
+void buildBindingTable(const mjModel *m, const sceneState &world, mujocoBindingTable &table){
+    table.robotQposAdr.clear();
+    table.robotJointCount.clear();
+    table.objectQposAdr.clear();
+    table.objectDofAdr.clear();
+    table.objectBodyId.clear();
+
+    // Robot joints are the first joints in the model, in the same order as the real robot
+    int jointIndex = 0;
+    for(int i = 0; i < world.robots.size(); i++){
+        for(int j = 0; j < world.robots[i].joint_positions.size(); j++){
+            int qposAdr = -1;
+            if(jointIndex >= m->njnt || m->jnt_type[jointIndex] == mjJNT_FREE || m->jnt_type[jointIndex] == mjJNT_BALL){
+                std::cout << "robot " << world.robots[i].name << " joint " << j << " has no matching hinge or slide joint in the model" << std::endl;
+            }
+            else{
+                qposAdr = m->jnt_qposadr[jointIndex];
+            }
+            table.robotQposAdr.push_back(qposAdr);
+            jointIndex++;
+        }
+        table.robotJointCount.push_back(world.robots[i].joint_positions.size());
+    }
+
+    for(int i = 0; i < world.objects.size(); i++){
+        int bodyId = mj_name2id(m, mjOBJ_BODY, world.objects[i].name.c_str());
+        int qposAdr = -1;
+        int dofAdr = -1;
+
+        if(bodyId == -1){
+            std::cout << "tracked object " << world.objects[i].name << " not found in the model, it will not be updated" << std::endl;
+        }
+        else if(m->body_jntnum[bodyId] < 1 || m->jnt_type[m->body_jntadr[bodyId]] != mjJNT_FREE){
+            std::cout << "tracked object " << world.objects[i].name << " does not have a free joint, it will not be updated" << std::endl;
+        }
+        else{
+            qposAdr = m->jnt_qposadr[m->body_jntadr[bodyId]];
+            dofAdr = m->jnt_dofadr[m->body_jntadr[bodyId]];
+        }
+
+        table.objectBodyId.push_back(bodyId);
+        table.objectQposAdr.push_back(qposAdr);
+        table.objectDofAdr.push_back(dofAdr);
+    }
+}
+
+bool bindingTableMatches(const mujocoBindingTable &table, const sceneState &world){
+    if(table.robotJointCount.size() != world.robots.size() || table.objectQposAdr.size() != world.objects.size()){
+        return false;
+    }
+    for(int i = 0; i < world.robots.size(); i++){
+        if(table.robotJointCount[i] != world.robots[i].joint_positions.size()){
+            return false;
+        }
+    }
+    return true;
+}
+
+void applyBindingTable(const mujocoBindingTable &table, const sceneState &world, mjData *d){
+    int robotAdrOffset = 0;
+    for(int i = 0; i < world.robots.size(); i++){
+        const int *qposAdr = &table.robotQposAdr[robotAdrOffset];
+        const double *jointPositions = world.robots[i].joint_positions.data();
+        for(int j = 0; j < table.robotJointCount[i]; j++){
+            if(qposAdr[j] >= 0){
+                d->qpos[qposAdr[j]] = jointPositions[j];
+            }
+        }
+        robotAdrOffset += table.robotJointCount[i];
+    }
+
+    // Scene objects are already in the MuJoCo frame, only the quaternion needs reordering
+    // from {x, y, z, w} to MuJoCo's {w, x, y, z}
+    for(int i = 0; i < world.objects.size(); i++){
+        const int adr = table.objectQposAdr[i];
+        const object_real &object = world.objects[i];
+        // Stale objects handed over to the simulator keep whatever state MuJoCo gives them
+        if(adr < 0 || object.simulated){
+            continue;
+        }
+        mjtNum *qpos = d->qpos + adr;
+        qpos[0] = object.positions[0];
+        qpos[1] = object.positions[1];
+        qpos[2] = object.positions[2];
+        qpos[3] = object.quaternion[3];
+        qpos[4] = object.quaternion[0];
+        qpos[5] = object.quaternion[1];
+        qpos[6] = object.quaternion[2];
+
+        // Free joint qvel is the linear velocity in the world frame followed by the angular
+        // velocity in the body's local frame
+        const Eigen::Quaterniond bodyQuat(object.quaternion[3], object.quaternion[0], object.quaternion[1], object.quaternion[2]);
+        const Eigen::Vector3d localAngular = bodyQuat.normalized().conjugate() * Eigen::Vector3d(object.angularVelocity[0], object.angularVelocity[1], object.angularVelocity[2]);
+        mjtNum *qvel = d->qvel + table.objectDofAdr[i];
+        qvel[0] = object.linearVelocity[0];
+        qvel[1] = object.linearVelocity[1];
+        qvel[2] = object.linearVelocity[2];
+        qvel[3] = localAngular(0);
+        qvel[4] = localAngular(1);
+        qvel[5] = localAngular(2);
+    }
+}
@@ -1,101 +1,633 @@
 #include "MuJoCo_node.h"
 
+#include <ros/package.h>
 
-MuJoCo_realRobot_ROS::MuJoCo_realRobot_ROS(int argc, char **argv, std::vector<std::string> optitrack_topic_names){
+#include <algorithm>
+#include <chrono>
+
+// How often waitUntilReady looks again
+#define READY_POLL_MS       5
+// Paused spins on a mocap frame in progress before fillObjectsStates starts yielding
+#define MOCAP_FRAME_SPINS   64
+
+MuJoCo_realRobot_ROS::MuJoCo_realRobot_ROS(int argc, char **argv, std::vector<std::string> optitrack_topic_names)
+    : MuJoCo_realRobot_ROS(argc, argv, std::vector<robotConfig>(1), optitrack_topic_names){
+}
+
+MuJoCo_realRobot_ROS::MuJoCo_realRobot_ROS(int argc, char **argv, const std::vector<robotConfig> &robotConfigs, std::vector<std::string> optitrack_topic_names){
 
     ros::init(argc, argv, "MuJoCo_node");
 
+    if(robotConfigs.empty()){
+        ROS_FATAL("at least one robot is needed");
+        throw std::invalid_argument("no robots given");
+    }
+    const std::string &baseRigidBody = robotConfigs[0].baseRigidBody;
+    if(baseRigidBody.empty() || baseRigidBody.find_first_of("/ \t") != std::string::npos){
+        ROS_FATAL_STREAM("invalid robot base rigid body name: '" << baseRigidBody << "'");
+        throw std::invalid_argument("invalid robot base rigid body name: '" + baseRigidBody + "'");
+    }
+
     n = new ros::NodeHandle();
     listener = new tf::TransformListener();
 
-    jointStates_sub = n->subscribe("joint_states", 10, &MuJoCo_realRobot_ROS::jointStates_callback, this);
-    frankaStates_sub = n->subscribe("/franka_state_controller/franka_states", 10, &MuJoCo_realRobot_ROS::frankaStates_callback, this);
-    robotBase_sub = n->subscribe("/mocap/rigid_bodies/pandaRobot/pose", 10, &MuJoCo_realRobot_ROS::robotBasePose_callback, this);
+    // Each group of callbacks gets its own queue and spinner thread, so the rate callbacks are
+    // processed at no longer depends on how often the user calls into this class
+    stateNh = new ros::NodeHandle();
+    stateNh->setCallbackQueue(&stateQueue);
+    mocapNh = new ros::NodeHandle();
+    mocapNh->setCallbackQueue(&mocapQueue);
 
-    for(int i = 0; i < optitrack_topic_names.size(); i++){
-        auto callback = std::bind(&MuJoCo_realRobot_ROS::optiTrack_callback, this, std::placeholders::_1, optitrack_topic_names[i]);
-        std::string topic = "/mocap/rigid_bodies/" + optitrack_topic_names[i] + "/pose";
-        optiTrack_sub.push_back(n->subscribe<geometry_msgs::PoseStamped>(topic, 1, callback));
+    if(optitrack_topic_names.size() > MAX_TRACKED_OBJECTS){
+        ROS_FATAL_STREAM("at most " << MAX_TRACKED_OBJECTS << " optitrack rigid bodies can be tracked");
+        throw std::invalid_argument("too many optitrack rigid bodies");
     }
 
-    numberOfObjects = optitrack_topic_names.size();
-    optitrack_objects = optitrack_topic_names;
-
-    torque_pub = new ros::Publisher(n->advertise<std_msgs::Float64MultiArray>("/effort_group_effort_controller/command", 1));
-    position_pub = new ros::Publisher(n->advertise<std_msgs::Float64MultiArray>("/effort_group_position_controller/command", 1));
-    velocity_pub = new ros::Publisher(n->advertise<std_msgs::Float64MultiArray>("/effort_velocity_controller/command", 1));
+    // Per object storage is sized for the most objects there can ever be, so objects found
+    // later on never move the buffers of the ones already being read
+    numberOfObjects = 0;
+    optitrack_objects.reserve(MAX_TRACKED_OBJECTS);
+    objectPoseHistory.resize(MAX_TRACKED_OBJECTS);
+    optitrack_objects_found = std::vector<std::atomic<bool>>(MAX_TRACKED_OBJECTS);
+    objectTopicState = std::vector<mocapTopicState>(MAX_TRACKED_OBJECTS);
+    objectDiscovered.resize(MAX_TRACKED_OBJECTS, false);
+    optiTrack_sub.reserve(MAX_TRACKED_OBJECTS);
+    for(int i = 0; i < MAX_TRACKED_OBJECTS; i++){
+        optitrack_objects_found[i] = false;
+    }
+    stalePolicy = STALE_HOLD;
+    staleTimeout = 0.1;
+    stalePredictHorizon = 0.25;
 
+    // Resolve every topic to its object index once, the callbacks are bound to that index
+    // so no lookup happens per message. Anything that cannot be resolved is rejected here.
     for(int i = 0; i < optitrack_topic_names.size(); i++){
-        objectTrackingList.push_back(objectTracking());
-        objectPoseList.push_back(m_pose_quat());
-        objectPosOffsetList.push_back(m_point());
-
-        objectTrackingList[i].parent_id = "/panda_link0";
-        objectTrackingList[i].target_id = "/ar_marker_3";
-        objectTrackingList[i].mujoco_name = optitrack_topic_names[i];
-        optitrack_objects_found.push_back(false);
+        const std::string &name = optitrack_topic_names[i];
+        if(name.empty() || name.find_first_of("/ \t") != std::string::npos){
+            ROS_FATAL_STREAM("invalid optitrack rigid body name: '" << name << "'");
+            throw std::invalid_argument("invalid optitrack rigid body name: '" + name + "'");
+        }
+        if(getObjectId(name) != -1){
+            ROS_FATAL_STREAM("optitrack rigid body '" << name << "' was requested more than once");
+            throw std::invalid_argument("duplicate optitrack rigid body name: '" + name + "'");
+        }
+        addObject(name);
+    }
+    requiredObjects = optitrack_topic_names.size();
+
+    // The first robot's base is the scene frame
+    robotBase_sub = mocapNh->subscribe("/mocap/rigid_bodies/" + robotConfigs[0].baseRigidBody + "/pose", 10, &MuJoCo_realRobot_ROS::robotBasePose_callback, this);
+
+    // How poses from the same mocap frame are brought together, see mocapSyncMode
+    ros::NodeHandle mocapParams("~");
+    std::string syncMode;
+    mocapParams.param<std::string>("mocap_sync", syncMode, "none");
+    mocapParams.param<double>("mocap_sync_tolerance", mocapSyncTolerance, 0.002);
+    // Well under one frame period at the usual 120 - 240 Hz mocap rates
+    mocapParams.param<double>("mocap_frame_timeout", mocapFrameTimeout, 0.003);
+    mocapParams.param<std::string>("mocap_array_topic", mocapArrayTopic, "");
+    if(syncMode == "exact"){
+        mocapSync = MOCAP_SYNC_EXACT;
+    }
+    else if(syncMode == "approximate"){
+        mocapSync = MOCAP_SYNC_APPROXIMATE;
+    }
+    else{
+        if(syncMode != "none"){
+            ROS_WARN_STREAM("unknown mocap_sync mode '" << syncMode << "', poses will not be synchronised");
+        }
+        mocapSync = MOCAP_SYNC_NONE;
+    }
+    mocapFrameSequence = 0;
+    subscribedObjects = 0;
+    pendingFramePoses.resize(7, MAX_TRACKED_OBJECTS);
+    pendingFrameStamps.resize(MAX_TRACKED_OBJECTS);
+    pendingFrameObjects.reserve(MAX_TRACKED_OBJECTS);
+    pendingFramePresent.resize(MAX_TRACKED_OBJECTS, false);
+
+    if(mocapArrayTopic.empty()){
+        for(int i = 0; i < numberOfObjects; i++){
+            subscribeObject(i);
+        }
+        // Checked at twice the timeout rate, a partial frame is applied at most 1.5 timeouts late
+        if(mocapSync != MOCAP_SYNC_NONE){
+            mocapFrameTimer = mocapNh->createTimer(ros::Duration(mocapFrameTimeout / 2.0), &MuJoCo_realRobot_ROS::mocapFrameTimeout_callback, this);
+        }
+    }
+    else{
+        // The aggregated topic carries every body in one message, ordered as mocap_array_bodies
+        std::vector<std::string> arrayBodies;
+        mocapParams.getParam("mocap_array_bodies", arrayBodies);
+        for(int i = 0; i < arrayBodies.size(); i++){
+            int objectId = getObjectId(arrayBodies[i]);
+            if(objectId == -1 && !arrayBodies[i].empty()){
+                objectId = addObject(arrayBodies[i]);
+            }
+            mocapArrayObjectIds.push_back(objectId);
+        }
+        mocapArray_sub = mocapNh->subscribe(mocapArrayTopic, 1, &MuJoCo_realRobot_ROS::mocapArray_callback, this);
     }
 
-    // TODO - when class is instantied, have it check what controllers are running and keep track of it
-    currentController = "position_joint_trajectory_controller";
+    commandTimeout_ns = 0;
+
+    // Commands and safety events are written to file off the hot path
+    ros::NodeHandle privateNh("~");
+    std::string commandLogFile;
+    privateNh.param<std::string>("command_log_file", commandLogFile, "/tmp/MuJoCo_realRobot_ROS_commands.log");
+    commandLogger.start(commandLogFile);
+
+    // The shipped yaml is the only copy of the default limits
+    std::string safetyLimitsFile;
+    privateNh.param<std::string>("safety_limits_file", safetyLimitsFile, ros::package::getPath("MuJoCo_realRobot_ROS") + "/config/safety_limits.yaml");
+
+    // Until the base is seen it is assumed to sit at the OptiTrack origin
+    privateNh.param<bool>("freeze_robot_base", freezeRobotBase, true);
+    privateNh.param<int>("robot_base_average_samples", baseAverageSamples, 100);
+    privateNh.param<double>("robot_base_tolerance", baseTolerance, 0.001);
+    privateNh.param<double>("robot_base_angle_tolerance", baseAngleTolerance, 0.01);
+    baseSampleCount = 0;
+    robotBaseFrozen = false;
+    robotBaseReceived = false;
+    robotBase << 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0;
+    updateBaseTransform(robotBase);
 
     jointsCallBackCalled = false;
     objectCallBackCalled = false;
 
+    mocapFilter = NULL;
+    discoveryNh = NULL;
+    discoverySpinner = NULL;
+    mocapFilterEnabled = false;
+    objectVelocityWindow = 0.05;
+
+    extrapolateJoints = false;
+    extrapolationHorizon = 0.1;
+
+    // Every robot gets its own subscriptions, publishers, controller manager and safety monitor
+    robotInterfaces.reserve(robotConfigs.size());
+    for(int i = 0; i < robotConfigs.size(); i++){
+        setupRobot(i, robotConfigs[i], safetyLimitsFile);
+    }
+
+    // Only start processing callbacks once everything they touch has been set up
+    stateSpinner = new ros::AsyncSpinner(1, &stateQueue);
+    mocapSpinner = new ros::AsyncSpinner(1, &mocapQueue);
+    stateSpinner->start();
+    mocapSpinner->start();
+
 }
 
-int MuJoCo_realRobot_ROS::getObjectId(std::string itemName){
-    for(int i = 0; i < optitrack_objects.size(); i++){
-        if(itemName == optitrack_objects[i]){
-            return i;
+void MuJoCo_realRobot_ROS::setupRobot(int robotId, const robotConfig &config, const std::string &defaultSafetyLimitsFile){
+    robotInterfaces.push_back(std::unique_ptr<robotInterface>(new robotInterface()));
+    robotInterface &robot = *robotInterfaces.back();
+    robot.config = config;
+
+    robot.torque_pub = n->advertise<std_msgs::Float64MultiArray>(config.torqueCommandTopic, 1);
+    robot.position_pub = n->advertise<std_msgs::Float64MultiArray>(config.positionCommandTopic, 1);
+    robot.velocity_pub = n->advertise<std_msgs::Float64MultiArray>(config.velocityCommandTopic, 1);
+    robot.torqueMsg.data.resize(NUM_JOINTS);
+    robot.positionMsg.data.resize(NUM_JOINTS);
+    robot.velocityMsg.data.resize(NUM_JOINTS);
+
+    robotCommand noCommand = robotCommand();
+    noCommand.type = COMMAND_NONE;
+    robot.commandMailbox.write(noCommand);
+
+    // Every robot starts from ~safety_limits_file, its own file only needs the limits that differ
+    if(!robot.safetyMonitor.loadLimits(defaultSafetyLimitsFile)){
+        ROS_FATAL_STREAM("could not load safety limits for " << config.name << " from " << defaultSafetyLimitsFile);
+        throw std::runtime_error("no safety limits");
+    }
+    if(!config.safetyLimitsFile.empty() && !robot.safetyMonitor.loadLimits(config.safetyLimitsFile)){
+        ROS_FATAL_STREAM("could not load safety limits for " << config.name << " from " << config.safetyLimitsFile);
+        throw std::runtime_error("no safety limits");
+    }
+
+    if(config.jointNames.size() != NUM_JOINTS){
+        ROS_FATAL_STREAM("robot " << config.name << " needs " << NUM_JOINTS << " joint names");
+        throw std::invalid_argument("wrong number of joint names for robot " + config.name);
+    }
+    robot.jointStateMessages = 0;
+
+    robot.latestJointState = jointStateSnapshot();
+    robot.jointState.write(robot.latestJointState);
+    robot.jointStateReceived = false;
+
+    // Queries the loaded and running controllers in the background straight away
+    robot.controllerManager = new ControllerManagerClient(n, config.controllerManagerNamespace);
+
+    // Takes the message event, its connection header identifies the publisher
+    boost::function<void(const ros::MessageEvent<sensor_msgs::JointState const>&)> jointStatesCallback =
+        std::bind(&MuJoCo_realRobot_ROS::jointStates_callback, this, std::placeholders::_1, robotId);
+    auto frankaStatesCallback = std::bind(&MuJoCo_realRobot_ROS::frankaStates_callback, this, std::placeholders::_1, robotId);
+    robot.jointStates_sub = stateNh->subscribe<sensor_msgs::JointState>(config.jointStatesTopic, 10, jointStatesCallback);
+    robot.frankaStates_sub = stateNh->subscribe<franka_msgs::FrankaState>(config.frankaStatesTopic, 10, frankaStatesCallback);
+}
+
+int MuJoCo_realRobot_ROS::getObjectId(const std::string &itemName){
+    auto it = optitrack_object_ids.find(itemName);
+    if(it == optitrack_object_ids.end()){
+        return -1;
+    }
+    return it->second;
+}
+
+int MuJoCo_realRobot_ROS::addObject(const std::string &name){
+    const int objectId = numberOfObjects.load(std::memory_order_relaxed);
+    if(objectId >= MAX_TRACKED_OBJECTS){
+        return -1;
+    }
+
+    optitrack_objects.push_back(name);
+    optitrack_object_ids.emplace(name, objectId);
+    objectPoseHistory[objectId].reset(new PoseHistory());
+    optiTrack_sub.push_back(ros::Subscriber());
+
+    // Readers only look at objects below the count, so it goes up once the object is complete
+    numberOfObjects.store(objectId + 1, std::memory_order_release);
+    return objectId;
+}
+
+void MuJoCo_realRobot_ROS::subscribeObject(int objectId){
+    auto callback = std::bind(&MuJoCo_realRobot_ROS::optiTrack_callback, this, std::placeholders::_1, objectId);
+    std::string topic = "/mocap/rigid_bodies/" + optitrack_objects[objectId] + "/pose";
+    optiTrack_sub[objectId] = mocapNh->subscribe<geometry_msgs::PoseStamped>(topic, 1, callback);
+    subscribedObjects++;
+}
+
+void MuJoCo_realRobot_ROS::enableMocapDiscovery(const std::vector<std::string> &modelBodyNames, double scanPeriod_s){
+    if(!mocapArrayTopic.empty()){
+        ROS_WARN("mocap discovery is not available when reading poses from an aggregated array topic");
+        return;
+    }
+
+    if(discoverySpinner != NULL){
+        return;
+    }
+
+    // The body list is only ever read by the discovery timer, on the discovery thread
+    discoveryBodyNames = std::unordered_set<std::string>(modelBodyNames.begin(), modelBodyNames.end());
+    discoveryNh = new ros::NodeHandle();
+    discoveryNh->setCallbackQueue(&discoveryQueue);
+    discoveryTimer = discoveryNh->createTimer(ros::Duration(scanPeriod_s), &MuJoCo_realRobot_ROS::mocapDiscovery_callback, this);
+    discoverySpinner = new ros::AsyncSpinner(1, &discoveryQueue);
+    discoverySpinner->start();
+}
+
+// Runs on the discovery thread, the only one adding objects once the constructor is done.
+// Readers only see an object once numberOfObjects covers it, and its subscription delivers
+// poses on the mocap thread as usual.
+void MuJoCo_realRobot_ROS::mocapDiscovery_callback(const ros::TimerEvent &event){
+    ros::master::V_TopicInfo topics;
+    if(!ros::master::getTopics(topics)){
+        return;
+    }
+
+    const std::string prefix = "/mocap/rigid_bodies/";
+    const std::string suffix = "/pose";
+    std::vector<bool> advertised(numberOfObjects, false);
+
+    for(const ros::master::TopicInfo &info : topics){
+        const std::string &topic = info.name;
+        if(info.datatype != "geometry_msgs/PoseStamped" || topic.size() <= prefix.size() + suffix.size() ||
+           topic.compare(0, prefix.size(), prefix) != 0 || topic.compare(topic.size() - suffix.size(), suffix.size(), suffix) != 0){
+            continue;
+        }
+
+        const std::string name = topic.substr(prefix.size(), topic.size() - prefix.size() - suffix.size());
+        if(name.find('/') != std::string::npos || discoveryBodyNames.count(name) == 0){
+            continue;
+        }
+
+        int objectId = getObjectId(name);
+        if(objectId == -1){
+            objectId = addObject(name);
+            if(objectId == -1){
+                ROS_WARN_STREAM_THROTTLE(10.0, "cannot track " << name << ", already tracking " << MAX_TRACKED_OBJECTS << " objects");
+                continue;
+            }
+            objectDiscovered[objectId] = true;
+            advertised.push_back(true);
+            ROS_INFO_STREAM("discovered mocap rigid body " << name);
+        }
+        advertised[objectId] = true;
+
+        if(!optiTrack_sub[objectId]){
+            subscribeObject(objectId);
+        }
+    }
+
+    // Discovered bodies whose topic went away are unsubscribed, they keep their index and
+    // go stale until the topic comes back
+    for(int i = 0; i < advertised.size(); i++){
+        if(objectDiscovered[i] && !advertised[i] && optiTrack_sub[i]){
+            optiTrack_sub[i].shutdown();
+            optiTrack_sub[i] = ros::Subscriber();
+            subscribedObjects--;
+            ROS_INFO_STREAM("mocap rigid body " << optitrack_objects[i] << " is no longer published");
         }
     }
-    // If object Id is not found, this will crash the program!
-    return -1;
 }
 
 // order of poses is {x, y, z, w, wx, wy, wz}
-void MuJoCo_realRobot_ROS::optiTrack_callback(const geometry_msgs::PoseStamped::ConstPtr &msg, const std::string& topic_name){
-    m_pose objectPose;
-    int objectId = getObjectId(topic_name);
+void MuJoCo_realRobot_ROS::optiTrack_callback(const geometry_msgs::PoseStamped::ConstPtr &msg, int objectId){
+    double newPose[7];
+
+    // Poses are kept in the OptiTrack frame, they are moved relative to the robot base when the
+    // scene is filled, so objects seen before the base still end up in the right place
+    newPose[0] = msg->pose.position.x;
+    newPose[1] = msg->pose.position.y;
+    newPose[2] = msg->pose.position.z;
+
+    newPose[3] = msg->pose.orientation.w;
+    newPose[4] = msg->pose.orientation.x;
+    newPose[5] = msg->pose.orientation.y;
+    newPose[6] = msg->pose.orientation.z;
+
+    recordArrival(objectId, msg->header.seq);
+
+    if(mocapSync == MOCAP_SYNC_NONE){
+        storePose(objectId, newPose, msg->header.stamp);
+    }
+    else{
+        addToMocapFrame(objectId, newPose, msg->header.stamp);
+    }
+}
+
+void MuJoCo_realRobot_ROS::mocapArray_callback(const geometry_msgs::PoseArray::ConstPtr &msg){
+    const int count = std::min(msg->poses.size(), mocapArrayObjectIds.size());
+
+    // Everything in the message is one mocap frame, readers see all of it or none of it
+    beginMocapFrame();
+    for(int i = 0; i < count; i++){
+        const int objectId = mocapArrayObjectIds[i];
+        const geometry_msgs::Pose &pose = msg->poses[i];
+        // Drivers fill bodies that were not tracked this frame with NaNs
+        if(objectId == -1 || !std::isfinite(pose.position.x) || !std::isfinite(pose.orientation.w)){
+            continue;
+        }
+
+        const double newPose[7] = {pose.position.x, pose.position.y, pose.position.z,
+                                   pose.orientation.w, pose.orientation.x, pose.orientation.y, pose.orientation.z};
+        recordArrival(objectId, msg->header.seq);
+        storePose(objectId, newPose, msg->header.stamp);
+    }
+    endMocapFrame();
+}
+
+bool MuJoCo_realRobot_ROS::sameMocapFrame(const ros::Time &a, const ros::Time &b){
+    if(mocapSync == MOCAP_SYNC_EXACT){
+        return a == b;
+    }
+    return std::abs((a - b).toSec()) <= mocapSyncTolerance;
+}
+
+void MuJoCo_realRobot_ROS::addToMocapFrame(int objectId, const double pose[7], const ros::Time &stamp){
+    if(!pendingFrameObjects.empty() && !sameMocapFrame(stamp, pendingFrameStamp)){
+        if(stamp < pendingFrameStamp){
+            // Straggler from a frame that has already been applied
+            storePose(objectId, pose, stamp);
+            return;
+        }
+        // A later frame has started, apply what arrived of this one
+        flushMocapFrame();
+    }
+
+    if(pendingFrameObjects.empty()){
+        pendingFrameStamp = stamp;
+        pendingFrameArrival = std::chrono::steady_clock::now();
+    }
+    if(!pendingFramePresent[objectId]){
+        pendingFramePresent[objectId] = true;
+        pendingFrameObjects.push_back(objectId);
+    }
+    pendingFramePoses.col(objectId) = Map<const Matrix<double, 7, 1>>(pose);
+    pendingFrameStamps[objectId] = stamp;
+
+    if(pendingFrameObjects.size() >= subscribedObjects){
+        flushMocapFrame();
+    }
+}
 
-    // For coordinate frames in mujoco, offset the object coordinates by the base frame of robot
-    // as that is origin in mujoco
-    objectPoseList[objectId](0) = msg->pose.position.x - robotBase(0);
-    objectPoseList[objectId](1) = msg->pose.position.y - robotBase(1);
-    objectPoseList[objectId](2) = msg->pose.position.z - robotBase(2);
+// Same thread as the pose callbacks, so the pending frame needs no locking
+void MuJoCo_realRobot_ROS::mocapFrameTimeout_callback(const ros::TimerEvent &event){
+    if(pendingFrameObjects.empty()){
+        return;
+    }
+    const double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - pendingFrameArrival).count();
+    if(waited >= mocapFrameTimeout){
+        flushMocapFrame();
+    }
+}
+
+void MuJoCo_realRobot_ROS::flushMocapFrame(){
+    beginMocapFrame();
+    for(int objectId : pendingFrameObjects){
+        storePose(objectId, pendingFramePoses.col(objectId).data(), pendingFrameStamps[objectId]);
+        pendingFramePresent[objectId] = false;
+    }
+    endMocapFrame();
+    pendingFrameObjects.clear();
+}
 
-    objectPoseList[objectId](3) = msg->pose.orientation.w;
-    objectPoseList[objectId](4) = msg->pose.orientation.x;
-    objectPoseList[objectId](5) = msg->pose.orientation.y;
-    objectPoseList[objectId](6) = msg->pose.orientation.z;
+void MuJoCo_realRobot_ROS::beginMocapFrame(){
+    // Odd while a frame is being written, same scheme as SeqLock
+    mocapFrameSequence.store(mocapFrameSequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void MuJoCo_realRobot_ROS::endMocapFrame(){
+    mocapFrameSequence.store(mocapFrameSequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void MuJoCo_realRobot_ROS::storePose(int objectId, const double pose[7], const ros::Time &stamp){
+    if(mocapFilterEnabled){
+        if(objectId >= mocapFilter->size()){
+            mocapFilter->resize(numberOfObjects.load(std::memory_order_acquire));
+        }
+        mocapFilter->setMeasurement(objectId, pose, stamp);
+    }
+    else{
+        objectPoseHistory[objectId]->add(pose, stamp);
+    }
 
     optitrack_objects_found[objectId] = true;
 }
 
+// Arrival time, sequence gaps and rate, used to spot bodies that stop publishing
+void MuJoCo_realRobot_ROS::recordArrival(int objectId, uint32_t seq){
+    mocapTopicState &topic = objectTopicState[objectId];
+    const int64_t arrival_ns = ros::Time::now().toNSec();
+    const uint64_t received = topic.received.load(std::memory_order_relaxed);
+    if(received > 0){
+        const uint32_t seqGap = seq - topic.lastSeq;
+        if(seqGap > 1){
+            topic.dropped.store(topic.dropped.load(std::memory_order_relaxed) + seqGap - 1, std::memory_order_relaxed);
+        }
+
+        const double interval = (arrival_ns - topic.lastArrival_ns.load(std::memory_order_relaxed)) * 1e-9;
+        if(interval > 0.0){
+            const double rate = topic.rate_hz.load(std::memory_order_relaxed);
+            topic.rate_hz.store(received == 1 ? 1.0 / interval : rate + 0.05 * (1.0 / interval - rate), std::memory_order_relaxed);
+        }
+    }
+    topic.lastSeq = seq;
+    topic.lastArrival_ns.store(arrival_ns, std::memory_order_relaxed);
+    topic.received.store(received + 1, std::memory_order_release);
+}
+
 MuJoCo_realRobot_ROS::~MuJoCo_realRobot_ROS(){
+    stopCommandThread();
+    commandLogger.stop();
+    for(int i = 0; i < robotInterfaces.size(); i++){
+        delete robotInterfaces[i]->controllerManager;
+    }
+
+    // Stop the spinner threads before anything their callbacks use is torn down
+    if(discoverySpinner != NULL){
+        discoveryTimer.stop();
+        discoverySpinner->stop();
+        delete discoverySpinner;
+        delete discoveryNh;
+    }
+    stateSpinner->stop();
+    mocapSpinner->stop();
+    delete stateSpinner;
+    delete mocapSpinner;
+
+    delete mocapFilter;
+
+    delete stateNh;
+    delete mocapNh;
     delete n;
     delete listener;
 }
 
-void MuJoCo_realRobot_ROS::jointStates_callback(const sensor_msgs::JointState &msg){
-    
-    // TODO - make this dependant on size of msg?
+void MuJoCo_realRobot_ROS::jointStates_callback(const ros::MessageEvent<sensor_msgs::JointState const> &event, int robotId){
+    robotInterface &robot = *robotInterfaces[robotId];
+    const sensor_msgs::JointState::ConstPtr msg = event.getConstMessage();
+
+    // Resolved once per publisher, otherwise this is a plain gather
+    const jointStateSource &source = findJointStateSource(robot, event.getConnectionHeaderPtr(), *msg);
+
+    // Joints missing from this message keep their last value
+    const int numPositions = msg->position.size();
+    int gathered = 0;
     for(int i = 0; i < NUM_JOINTS; i++){
-        jointVals[i] = msg.position[i];
+        const int index = source.index[i];
+        if(index >= 0 && index < numPositions){
+            robot.latestJointState.q[i] = msg->position[index];
+            gathered++;
+        }
+    }
+    // Messages meant for another arm on a shared topic say nothing about this one
+    if(gathered == 0){
+        return;
     }
+    robot.latestJointState.q_stamp = msg->header.stamp;
+    robot.jointState.write(robot.latestJointState);
+
+    if(!robot.jointStateReceived){
+        robot.jointStateReceived = true;
+        bool allRobotsReceived = true;
+        for(int i = 0; i < robotInterfaces.size(); i++){
+            if(!robotInterfaces[i]->jointStateReceived){
+                allRobotsReceived = false;
+            }
+        }
+        if(allRobotsReceived){
+            jointsCallBackCalled = true;
+        }
+    }
+}
 
-    jointsCallBackCalled = true;
+// Pointer and count comparisons only, unless the message comes from a publisher not seen yet.
+// Messages without a connection header can not be told apart and are resolved every time.
+const jointStateSource& MuJoCo_realRobot_ROS::findJointStateSource(robotInterface &robot, const boost::shared_ptr<ros::M_string> &connection,
+                                                                   const sensor_msgs::JointState &msg){
+    const uint64_t message = ++robot.jointStateMessages;
+    const int nameCount = msg.name.size();
+
+    jointStateSource *leastRecent = &robot.jointStateSources[0];
+    for(int i = 0; i < JOINT_STATE_SOURCES; i++){
+        jointStateSource &source = robot.jointStateSources[i];
+        if(source.connection && source.connection == connection){
+            if(source.nameCount != nameCount){
+                buildJointStateIndex(robot, source, msg);
+            }
+            source.lastUsed = message;
+            return source;
+        }
+        if(source.lastUsed < leastRecent->lastUsed){
+            leastRecent = &source;
+        }
+    }
+
+    leastRecent->connection = connection;
+    leastRecent->lastUsed = message;
+    buildJointStateIndex(robot, *leastRecent, msg);
+    return *leastRecent;
 }
 
-void MuJoCo_realRobot_ROS::frankaStates_callback(const franka_msgs::FrankaState &msg){
+void MuJoCo_realRobot_ROS::buildJointStateIndex(robotInterface &robot, jointStateSource &source, const sensor_msgs::JointState &msg){
+    source.nameCount = msg.name.size();
+
+    // Unnamed messages are taken to be in robot joint order
+    if(msg.name.empty()){
+        for(int i = 0; i < NUM_JOINTS; i++){
+            source.index[i] = i;
+        }
+        source.jointsFound = NUM_JOINTS;
+        return;
+    }
 
+    source.jointsFound = 0;
     for(int i = 0; i < NUM_JOINTS; i++){
-        jointSpeeds[i] = msg.dq[i];
+        auto it = std::find(msg.name.begin(), msg.name.end(), robot.config.jointNames[i]);
+        if(it == msg.name.end()){
+            source.index[i] = -1;
+        }
+        else{
+            source.index[i] = it - msg.name.begin();
+            source.jointsFound++;
+        }
+    }
+
+    // None of the joints is normal for another arm's message on a shared topic, some is not
+    if(source.jointsFound > 0 && source.jointsFound < NUM_JOINTS){
+        ROS_WARN_STREAM_THROTTLE(1.0, robot.config.name << " joint_states messages only have " << source.jointsFound << " of its " << NUM_JOINTS << " joints");
+    }
+}
+
+void MuJoCo_realRobot_ROS::frankaStates_callback(const franka_msgs::FrankaState::ConstPtr &msg, int robotId){
+    robotInterface &robot = *robotInterfaces[robotId];
+
+    for(int i = 0; i < NUM_JOINTS; i++){
+        robot.latestJointState.dq[i] = msg->dq[i];
+    }
+    robot.latestJointState.dq_stamp = msg->header.stamp;
+
+    // Safety is checked at the full state rate, independent of whether commands are being sent
+    bool newHalt = robot.safetyMonitor.update(Map<const jointArray>(msg->q.data()), Map<const jointArray>(msg->dq.data()),
+                                              Map<const jointArray>(msg->tau_J.data()), msg->header.stamp);
+
+    // The monitor already filters an acceleration estimate, reuse it for extrapolation
+    Map<jointArray>(robot.latestJointState.ddq) = robot.safetyMonitor.accelerationEstimate();
+    robot.jointState.write(robot.latestJointState);
+
+    if(newHalt){
+        const safetyEvent event = robot.safetyMonitor.lastEvent();
+        const double values[2] = {event.value, event.limit};
+        commandLogger.log(LOG_SAFETY_VELOCITY + event.reason - SAFETY_VELOCITY, event.joint, values, 2, robotId);
     }
 }
 
 void MuJoCo_realRobot_ROS::robotBasePose_callback(const geometry_msgs::PoseStamped &msg){
+    if(robotBaseFrozen){
+        return;
+    }
+    robotBaseReceived = true;
+
     robotBase(0) = msg.pose.position.x;
     robotBase(1) = msg.pose.position.y;
     robotBase(2) = msg.pose.position.z;
@@ -104,22 +636,169 @@ void MuJoCo_realRobot_ROS::robotBasePose_callback(const geometry_msgs::PoseStamp
     robotBase(4) = msg.pose.orientation.x;
     robotBase(5) = msg.pose.orientation.y;
     robotBase(6) = msg.pose.orientation.z;
+
+    if(!freezeRobotBase){
+        updateBaseTransform(robotBase);
+        return;
+    }
+
+    const m_point position = robotBase.head<3>();
+    m_quat quat = robotBase.tail<4>();
+    if(baseSampleCount == 0){
+        basePositionSum.setZero();
+        baseQuatSum.setZero();
+        baseMin = position;
+        baseMax = position;
+        baseMaxAngle = 0.0;
+    }
+    else{
+        // q and -q are the same rotation, keep every sample on one side so they can be averaged
+        if(quat.dot(baseQuatSum) < 0.0){
+            quat = -quat;
+        }
+        const double cosHalfAngle = std::min(1.0, std::abs(quat.dot(baseQuatSum.normalized())));
+        baseMaxAngle = std::max(baseMaxAngle, 2.0 * std::acos(cosHalfAngle));
+    }
+
+    basePositionSum += position;
+    baseQuatSum += quat;
+    baseMin = baseMin.cwiseMin(position);
+    baseMax = baseMax.cwiseMax(position);
+    baseSampleCount++;
+
+    if(baseSampleCount < baseAverageSamples){
+        updateBaseTransform(robotBase);
+        return;
+    }
+
+    // A full batch, freeze on its average if the base stayed still, otherwise start another one
+    baseSampleCount = 0;
+    if((baseMax - baseMin).maxCoeff() > baseTolerance || baseMaxAngle > baseAngleTolerance){
+        updateBaseTransform(robotBase);
+        return;
+    }
+
+    robotBase.head<3>() = basePositionSum / baseAverageSamples;
+    robotBase.tail<4>() = baseQuatSum.normalized();
+    updateBaseTransform(robotBase);
+    robotBaseFrozen = true;
+    robotBase_sub.shutdown();
+    ROS_INFO_STREAM("robot base frozen at " << robotBase.transpose());
+}
+
+// Matrices of the quaternion products q * p and p * q as functions of p, all in {w, x, y, z}
+static Matrix4d quatLeftMatrix(const Quaterniond &q){
+    Matrix4d result;
+    result << q.w(), -q.x(), -q.y(), -q.z(),
+              q.x(),  q.w(), -q.z(),  q.y(),
+              q.y(),  q.z(),  q.w(), -q.x(),
+              q.z(), -q.y(),  q.x(),  q.w();
+    return result;
+}
+
+static Matrix4d quatRightMatrix(const Quaterniond &q){
+    Matrix4d result;
+    result << q.w(), -q.x(), -q.y(), -q.z(),
+              q.x(),  q.w(),  q.z(), -q.y(),
+              q.y(), -q.z(),  q.w(),  q.x(),
+              q.z(),  q.y(), -q.x(),  q.w();
+    return result;
+}
+
+void MuJoCo_realRobot_ROS::updateBaseTransform(const m_pose_quat &basePose){
+    // OptiTrack is y up and MuJoCo z up, a quarter turn about x
+    const Quaterniond frameChange(AngleAxisd(PI/2, Vector3d::UnitX()));
+    const Quaterniond baseQuat = Quaterniond(basePose(3), basePose(4), basePose(5), basePose(6)).normalized();
+    const Quaterniond toMujoco = frameChange * baseQuat.conjugate();
+
+    robotBaseTransform transform;
+    Map<Matrix3d> rotation(transform.rotation);
+    rotation = toMujoco.toRotationMatrix();
+    Map<Vector3d>(transform.translation) = -rotation * basePose.head<3>();
+    // The objects' own axes are also y up, so they get the frame change on the right as well
+    Map<Matrix4d>(transform.quatTransform) = quatLeftMatrix(toMujoco) * quatRightMatrix(frameChange.conjugate());
+
+    baseTransform.write(transform);
+}
+
+bool MuJoCo_realRobot_ROS::isRobotBaseFrozen(){
+    return robotBaseFrozen;
+}
+
+readinessState MuJoCo_realRobot_ROS::getReadiness(){
+    readinessState state;
+    state.jointStates = jointsCallBackCalled;
+    state.robotBase = freezeRobotBase ? robotBaseFrozen.load() : robotBaseReceived.load();
+    for(int i = 0; i < requiredObjects; i++){
+        if(!optitrack_objects_found[i]){
+            state.missingObjects.push_back(optitrack_objects[i]);
+        }
+    }
+    return state;
+}
+
+bool MuJoCo_realRobot_ROS::waitUntilReady(double timeout_s, readinessState *state){
+    // Everything arrives on the spinner threads, so this only has to keep looking
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout_s);
+    readinessState current = getReadiness();
+    while(!current.ready() && ros::ok() && std::chrono::steady_clock::now() < deadline){
+        std::this_thread::sleep_for(std::chrono::milliseconds(READY_POLL_MS));
+        current = getReadiness();
+    }
+
+    if(state != NULL){
+        *state = current;
+    }
+    return current.ready();
+}
+
+void MuJoCo_realRobot_ROS::enableMocapFilter(const mocapFilterParams &params, double rate_hz){
+    if(mocapFilter != NULL){
+        return;
+    }
+
+    // Sized to the objects tracked so far, storePose grows it as more are discovered
+    mocapFilter = new MocapFilterBank(numberOfObjects.load(std::memory_order_acquire), params);
+    mocapFilterEnabled = true;
+    mocapFilterTimer = mocapNh->createTimer(ros::Duration(1.0 / rate_hz), &MuJoCo_realRobot_ROS::mocapFilter_callback, this);
+}
+
+void MuJoCo_realRobot_ROS::mocapFilter_callback(const ros::TimerEvent &event){
+    if(mocapFilter->update() == 0){
+        return;
+    }
+
+    double filteredPose[7];
+    beginMocapFrame();
+    for(int i = 0; i < mocapFilter->size(); i++){
+        if(mocapFilter->updated(i)){
+            mocapFilter->filteredPose(i, filteredPose);
+            objectPoseHistory[i]->add(filteredPose, mocapFilter->measurementStamp(i));
+        }
+    }
+    endMocapFrame();
 }
 
 sceneState MuJoCo_realRobot_ROS::returnScene(){
     sceneState world;
+    fillScene(world);
 
-    ros::spinOnce();
-    std::vector<robot_real> robots = returnRobotState();
-    std::vector<object_real> objects = returnObjectsStates();
+    return world;
+}
 
-    world.robots = robots;
-    world.objects = objects;
+void MuJoCo_realRobot_ROS::fillScene(sceneState &world){
+    fillScene(world, ros::Time());
+}
+
+void MuJoCo_realRobot_ROS::fillScene(sceneState &world, const ros::Time &sampleTime){
+
+    fillRobotState(world.robots, sampleTime);
+    fillObjectsStates(world.objects, sampleTime);
 
     // Setting up a callback flag so you can pause execution until all objects found
     if(!objectCallBackCalled){
         bool allobjectsFound = true;
-        for(int i = 0; i < optitrack_objects_found.size(); i++){
+        for(int i = 0; i < numberOfObjects; i++){
             if(!optitrack_objects_found[i]){
                 allobjectsFound = false;
             }
@@ -128,65 +807,213 @@ sceneState MuJoCo_realRobot_ROS::returnScene(){
             objectCallBackCalled = true;
         }
     }
+}
 
-    return world;
+void MuJoCo_realRobot_ROS::setStaleObjectPolicy(staleObjectPolicy policy, double timeout_s, double predictHorizon_s){
+    staleTimeout = timeout_s;
+    stalePredictHorizon = predictHorizon_s;
+    stalePolicy = policy;
 }
 
-// TODO - should probably add abaility for multiple robots, which should be specified by constructo call
-std::vector<robot_real> MuJoCo_realRobot_ROS::returnRobotState() {
+mocapTopicStats MuJoCo_realRobot_ROS::getMocapStats(int objectId){
+    const mocapTopicState &topic = objectTopicState[objectId];
 
-    std::vector<robot_real> robots;
-    robots.push_back(robot_real());
-    robots[0].name = "panda";
+    mocapTopicStats stats;
+    stats.received = topic.received.load(std::memory_order_acquire);
+    stats.dropped = topic.dropped.load(std::memory_order_relaxed);
+    stats.rate_hz = topic.rate_hz.load(std::memory_order_relaxed);
+    stats.age = std::numeric_limits<double>::infinity();
+    if(stats.received > 0){
+        stats.age = (ros::Time::now().toNSec() - topic.lastArrival_ns.load(std::memory_order_relaxed)) * 1e-9;
+    }
+    return stats;
+}
 
-    for(int i = 0; i < NUM_JOINTS; i++){
-        if(i == 5){
-            robots[0].joint_positions.push_back(jointVals[i] - PI/2);
-        }
-        else if(i == 6){
-            robots[0].joint_positions.push_back(jointVals[i] - PI/4);
-        }
-        else{
-            robots[0].joint_positions.push_back(jointVals[i]);
-        }
+void MuJoCo_realRobot_ROS::setObjectVelocityWindow(double window_s){
+    objectVelocityWindow = window_s;
+}
 
+void MuJoCo_realRobot_ROS::setJointExtrapolation(bool enabled, double maxHorizon_s){
+    extrapolationHorizon = maxHorizon_s;
+    extrapolateJoints = enabled;
+}
+
+void MuJoCo_realRobot_ROS::fillRobotState(std::vector<robot_real> &robots, const ros::Time &sampleTime) {
+
+    // Names and storage are only set up the first time this buffer is filled
+    const int robotCount = robotInterfaces.size();
+    if(robots.size() != robotCount){
+        robots.resize(robotCount);
+        for(int i = 0; i < robotCount; i++){
+            robots[i].id = i;
+            robots[i].name = robotInterfaces[i]->config.name;
+            robots[i].joint_positions.resize(NUM_JOINTS);
+        }
     }
 
+    // One target time for every robot so the arms are consistent with each other
+    const ros::Time target = sampleTime.isZero() ? ros::Time::now() : sampleTime;
+    const bool extrapolate = extrapolateJoints;
+    const double horizon = extrapolationHorizon;
+
+    for(int i = 0; i < robotCount; i++){
+        const robotInterface &robot = *robotInterfaces[i];
+        jointStateSnapshot jointState = robot.jointState.read();
+        Map<jointArray> q(jointState.q);
 
-    return robots;
+        if(extrapolate && !jointState.q_stamp.isZero()){
+            const double dt = std::clamp((target - jointState.q_stamp).toSec(), -horizon, horizon);
+            q += Map<const jointArray>(jointState.dq) * dt + 0.5 * Map<const jointArray>(jointState.ddq) * dt * dt;
+        }
+
+        Map<jointArray>(robots[i].joint_positions.data()) = q - robot.config.jointOffsets;
+    }
 }
 
-std::vector<object_real> MuJoCo_realRobot_ROS::returnObjectsStates(){
+void MuJoCo_realRobot_ROS::fillObjectsStates(std::vector<object_real> &objects, const ros::Time &sampleTime){
     tf::StampedTransform transform;
-    std::vector<object_real> objects;
     if(OPTITRACK){
-        for(int i = 0; i < numberOfObjects; i++){
-            objects.push_back(object_real());
-            objects[i].name = optitrack_objects[i];
+        // Objects can be discovered while running, take one count and stick to it
+        const int objectCount = numberOfObjects.load(std::memory_order_acquire);
+        if(objects.size() != objectCount){
+            objects.resize(objectCount);
+            for(int i = 0; i < objectCount; i++){
+                objects[i].id = i;
+                objects[i].name = optitrack_objects[i];
+            }
+        }
+
+        // Gather every object's OptiTrack frame state into columns, fixed capacity so nothing
+        // is allocated
+        Matrix<double, 3, Dynamic, ColMajor, 3, MAX_TRACKED_OBJECTS> positions(3, objectCount);
+        Matrix<double, 4, Dynamic, ColMajor, 4, MAX_TRACKED_OBJECTS> quats(4, objectCount);
+        Matrix<double, 3, Dynamic, ColMajor, 3, MAX_TRACKED_OBJECTS> linear(3, objectCount);
+        Matrix<double, 3, Dynamic, ColMajor, 3, MAX_TRACKED_OBJECTS> angular(3, objectCount);
+        bool seen[MAX_TRACKED_OBJECTS];
+        ros::Time newestStamp[MAX_TRACKED_OBJECTS];
+
+        // Retry if a mocap frame was applied part way through, so every object comes from the
+        // same frame
+        uint32_t frameBefore;
+        do{
+            // A frame only takes a few pose writes, pause while it lands and give the core
+            // away if the mocap thread was preempted part way through
+            int spins = 0;
+            while((frameBefore = mocapFrameSequence.load(std::memory_order_acquire)) & 1){
+                if(++spins < MOCAP_FRAME_SPINS){
+                    cpuRelax();
+                }
+                else{
+                    std::this_thread::yield();
+                }
+            }
+
+            for(int i = 0; i < objectCount; i++){
+                double pose[7] = {0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0};
+                stampedPose latestPose;
+                seen[i] = objectPoseHistory[i]->latest(latestPose);
+                if(seen[i]){
+                    newestStamp[i] = latestPose.stamp;
+                    if(sampleTime.isZero()){
+                        for(int j = 0; j < 7; j++){
+                            pose[j] = latestPose.pose[j];
+                        }
+                    }
+                    else{
+                        objectPoseHistory[i]->poseAt(sampleTime, pose);
+                    }
+                }
+                positions.col(i) = Map<const Vector3d>(pose);
+                quats.col(i) = Map<const Vector4d>(pose + 3);
+
+                linear.col(i).setZero();
+                angular.col(i).setZero();
+                objectPoseHistory[i]->velocityAt(sampleTime, objectVelocityWindow, linear.col(i).data(), angular.col(i).data());
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }while(mocapFrameSequence.load(std::memory_order_relaxed) != frameBefore);
+
+        // Move everything into the MuJoCo frame in one pass
+        const robotBaseTransform transform = baseTransform.read();
+        const Map<const Matrix3d> rotation(transform.rotation);
+        positions = (rotation * positions).colwise() + Map<const Vector3d>(transform.translation);
+        quats = Map<const Matrix4d>(transform.quatTransform) * quats;
+        linear = rotation * linear;
+        angular = rotation * angular;
+
+        const ros::Time now = ros::Time::now();
+        const ros::Time target = sampleTime.isZero() ? now : sampleTime;
+        const int policy = stalePolicy;
+        const double timeout = staleTimeout;
+        const double horizon = stalePredictHorizon;
+
+        for(int i = 0; i < objectCount; i++){
+            objects[i].age = std::numeric_limits<double>::infinity();
+            objects[i].valid = false;
+            objects[i].simulated = false;
+
+            // Objects that have not been seen yet stay at the origin
+            if(!seen[i]){
+                positions.col(i).setZero();
+                quats.col(i) << 1.0, 0.0, 0.0, 0.0;
+            }
+            else{
+                objects[i].age = (now.toNSec() - objectTopicState[i].lastArrival_ns.load(std::memory_order_relaxed)) * 1e-9;
+                objects[i].valid = objects[i].age <= timeout;
+            }
+
+            if(seen[i] && !objects[i].valid){
+                ROS_WARN_STREAM_THROTTLE(1.0, "no mocap data for " << optitrack_objects[i] << " in " << objects[i].age << " s");
+
+                if(policy == STALE_PREDICT){
+                    // Constant velocity from the newest pose, up to the horizon
+                    const double dt = std::clamp((target - newestStamp[i]).toSec(), 0.0, horizon);
+                    positions.col(i) += linear.col(i) * dt;
+                    const double angle = angular.col(i).norm() * dt;
+                    if(angle > 0.0){
+                        const Quaterniond turn(AngleAxisd(angle, angular.col(i).normalized()));
+                        quats.col(i) = quatLeftMatrix(turn) * quats.col(i);
+                    }
+                }
+                else if(policy == STALE_SIMULATE){
+                    objects[i].simulated = true;
+                }
+
+                if(policy == STALE_HOLD || objects[i].age > horizon){
+                    linear.col(i).setZero();
+                    angular.col(i).setZero();
+                }
+            }
+
             // x, y, z
-            objects[i].positions[0] = objectPoseList[i](0);
-            objects[i].positions[1] = -objectPoseList[i](2);
-            objects[i].positions[2] = objectPoseList[i](1);
+            objects[i].positions[0] = positions(0, i);
+            objects[i].positions[1] = positions(1, i);
+            objects[i].positions[2] = positions(2, i);
 
-            // This seems so random, Optitrack and mujoco conversion is weird...
             // x, y, z, w
-            objects[i].quaternion[0] = objectPoseList[i](4);
-            objects[i].quaternion[1] = -objectPoseList[i](6);
-            objects[i].quaternion[2] = objectPoseList[i](5);
-            objects[i].quaternion[3] = objectPoseList[i](3);
+            objects[i].quaternion[0] = quats(1, i);
+            objects[i].quaternion[1] = quats(2, i);
+            objects[i].quaternion[2] = quats(3, i);
+            objects[i].quaternion[3] = quats(0, i);
+
+            for(int j = 0; j < 3; j++){
+                objects[i].linearVelocity[j] = linear(j, i);
+                objects[i].angularVelocity[j] = angular(j, i);
+            }
 
 //            int itemId = mj_name2id(m, mjOBJ_BODY, objectTrackingList[i].mujoco_name.c_str());
 //            m_point bodyPoint;
-//            bodyPoint(0) = objectPoseList[i](0); //  + objectPosOffsetList[i](0);    // mujoco x
-//            bodyPoint(1) = -objectPoseList[i](2); // + objectPosOffsetList[0](2);    // mujoco y
-//            bodyPoint(2) = objectPoseList[i](1); //  + objectPosOffsetList[0](1);    // mujoco z (up/down)
+//            bodyPoint(0) = pose[0]; //  + objectPosOffsetList[i](0);    // mujoco x
+//            bodyPoint(1) = -pose[2]; // + objectPosOffsetList[0](2);    // mujoco y
+//            bodyPoint(2) = pose[1]; //  + objectPosOffsetList[0](1);    // mujoco z (up/down)
 //            set_BodyPosition(m, d, itemId, bodyPoint);
 //
 //            Quaternionf q;
-//            q.w() = objectPoseList[i](3);
-//            q.x() = objectPoseList[i](4);
-//            q.y() = -objectPoseList[i](6);
-//            q.z() = objectPoseList[i](5);
+//            q.w() = pose[3];
+//            q.x() = pose[4];
+//            q.y() = -pose[6];
+//            q.z() = pose[5];
 //            setBodyQuat(m, d, itemId, q);
         }
     }
@@ -219,151 +1046,185 @@ std::vector<object_real> MuJoCo_realRobot_ROS::returnObjectsStates(){
 //            }
 //        }
 //    }
+}
 
-    return objects;
+int MuJoCo_realRobot_ROS::numberOfRobots(){
+    return robotInterfaces.size();
 }
 
-// TODO - check loaded controllers, only load controller if required.
-bool MuJoCo_realRobot_ROS::switchController(std::string controllerName){
-    ros::ServiceClient load_controller = n->serviceClient<controller_manager_msgs::LoadController>("/controller_manager/load_controller");
+std::shared_future<bool> MuJoCo_realRobot_ROS::switchController(std::string controllerName){
+    return switchController(0, controllerName);
+}
 
-    controller_manager_msgs::LoadController load_controller_req;
-    load_controller_req.request.name = controllerName;
-    load_controller.call(load_controller_req);
+std::shared_future<bool> MuJoCo_realRobot_ROS::switchController(int robotId, std::string controllerName){
+    return robotInterfaces[robotId]->controllerManager->switchController(controllerName);
+}
 
-    ros::ServiceClient switch_controller = n->serviceClient<controller_manager_msgs::SwitchController>("/controller_manager/switch_controller");
+void MuJoCo_realRobot_ROS::sendTorquesToRealRobot(double torques[]){
+    sendTorquesToRealRobot(0, torques);
+}
+
+void MuJoCo_realRobot_ROS::sendPositionsToRealRobot(double positions[]){
+    sendPositionsToRealRobot(0, positions);
+}
+
+void MuJoCo_realRobot_ROS::sendVelocitiesToRealRobot(double velocities[]){
+    sendVelocitiesToRealRobot(0, velocities);
+}
 
-    std::vector<std::string> start_controller;
-    start_controller.push_back(controllerName);
-    std::vector<std::string> stop_controller;
-    stop_controller.push_back("position_joint_trajectory_controller");
-    controller_manager_msgs::SwitchController switch_controller_req;
-    switch_controller_req.request.start_controllers = start_controller;
-    switch_controller_req.request.stop_controllers = stop_controller;
-    switch_controller_req.request.strictness = 1;
-    switch_controller_req.request.start_asap = false;
-    ros::service::waitForService("/controller_manager/switch_controller", ros::Duration(5));
-    switch_controller.call(switch_controller_req);
-    if (switch_controller_req.response.ok){
-        ROS_INFO_STREAM("Controller switch correctly");
+void MuJoCo_realRobot_ROS::sendTorquesToRealRobot(int robotId, const double torques[]){
+    if(commandLoop.isRunning()){
+        submitCommand(robotId, COMMAND_TORQUE, torques);
     }
     else{
-        ROS_ERROR_STREAM("Error occured trying to switch controller");
-        return 0;
+        publishTorques(robotId, torques);
     }
+}
 
-    return switch_controller_req.response.ok;
+void MuJoCo_realRobot_ROS::sendPositionsToRealRobot(int robotId, const double positions[]){
+    if(commandLoop.isRunning()){
+        submitCommand(robotId, COMMAND_POSITION, positions);
+    }
+    else{
+        publishPositions(robotId, positions);
+    }
 }
 
-void MuJoCo_realRobot_ROS::sendTorquesToRealRobot(double torques[]){
-    std_msgs::Float64MultiArray  desired_torques;
-    double jointSpeedLimits[NUM_JOINTS] = {0.7, 0.7, 0.7, 0.7, 1.5, 1.5, 1.5};
-    bool jointVelsSafe = true;
-    std::cout << "sending torques \n";
+void MuJoCo_realRobot_ROS::sendVelocitiesToRealRobot(int robotId, const double velocities[]){
+    if(commandLoop.isRunning()){
+        submitCommand(robotId, COMMAND_VELOCITY, velocities);
+    }
+    else{
+        publishVelocities(robotId, velocities);
+    }
+}
 
-    if(!haltRobot){
-        std::cout << "torques Sent: " << torques[0] << ", " << torques[1] << ", " << torques[2] << ", " << torques[3] << ", " << torques[4] << ", " << torques[5] << ", " << torques[6] << ", " << std::endl;
-        for(int i = 0; i < NUM_JOINTS; i++){
-            double safeTorque = torques[i];
+void MuJoCo_realRobot_ROS::startCommandThread(const realTimeLoopConfig &config, double commandTimeout_s){
+    if(commandLoop.isRunning()){
+        return;
+    }
+    commandTimeout_ns = (int64_t)(commandTimeout_s * 1e9);
+    commandLoop.start(config, std::bind(&MuJoCo_realRobot_ROS::commandCycle, this));
+}
 
-            if(jointSpeeds[i] > jointSpeedLimits[i]){
-                std::cout << "joint " << i <<  " speed: " << jointSpeeds[i] << std::endl;
-                std::cout << "safety vel triggered" << std::endl;
-                haltRobot = true;
-                safeTorque = 0.0;
-            }
+void MuJoCo_realRobot_ROS::stopCommandThread(){
+    commandLoop.stop();
+}
+
+realTimeLoopStats MuJoCo_realRobot_ROS::getCommandThreadStats(){
+    return commandLoop.getStats();
+}
+
+static int64_t steadyTime_ns(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-            if(jointSpeeds[i] < -jointSpeedLimits[i]){
-                std::cout << "joint " << i <<  " speed: " << jointSpeeds[i] << std::endl;
-                std::cout << "safety vel triggered" << std::endl;
-                haltRobot = true;
-                safeTorque = 0.0;
+void MuJoCo_realRobot_ROS::submitCommand(int robotId, int type, const double values[]){
+    robotCommand command;
+    command.type = type;
+    for(int i = 0; i < NUM_JOINTS; i++){
+        command.values[i] = values[i];
+    }
+    command.submitTime_ns = steadyTime_ns();
+    robotInterfaces[robotId]->commandMailbox.write(command);
+}
+
+// Runs on the command thread every cycle
+void MuJoCo_realRobot_ROS::commandCycle(){
+    const int64_t now_ns = steadyTime_ns();
+    const double zeros[NUM_JOINTS] = {0.0};
+
+    for(int robotId = 0; robotId < robotInterfaces.size(); robotId++){
+        const robotCommand command = robotInterfaces[robotId]->commandMailbox.read();
+        const bool stale = now_ns - command.submitTime_ns > commandTimeout_ns;
+
+        if(command.type == COMMAND_TORQUE){
+            publishTorques(robotId, stale ? zeros : command.values);
+        }
+        else if(command.type == COMMAND_POSITION){
+            if(!stale){
+                publishPositions(robotId, command.values);
             }
+        }
+        else if(command.type == COMMAND_VELOCITY){
+            publishVelocities(robotId, stale ? zeros : command.values);
+        }
+    }
+}
+
+void MuJoCo_realRobot_ROS::publishTorques(int robotId, const double torques[]){
+    robotInterface &robot = *robotInterfaces[robotId];
+    std_msgs::Float64MultiArray &desired_torques = robot.torqueMsg;
 
-            desired_torques.data.push_back(safeTorque);
+    if(!robot.safetyMonitor.isHalted()){
+        commandLogger.log(LOG_TORQUE_COMMAND, -1, torques, NUM_JOINTS, robotId);
+        for(int i = 0; i < NUM_JOINTS; i++){
+            desired_torques.data[i] = torques[i];
         }
 
-        torque_pub->publish(desired_torques);
+        robot.torque_pub.publish(desired_torques);
     }
     else{
         for(int i = 0; i < NUM_JOINTS; i++){
-            desired_torques.data.push_back(0.0);
+            desired_torques.data[i] = 0.0;
         }
-        torque_pub->publish(desired_torques);
+        robot.torque_pub.publish(desired_torques);
     }
 }
 
-void MuJoCo_realRobot_ROS::sendPositionsToRealRobot(double positions[]){
-    std_msgs::Float64MultiArray  desired_positions;
-    double jointSpeedLimits[NUM_JOINTS] = {0.7, 0.7, 0.7, 0.7, 1.5, 1.5, 1.5};
-    //double torqueLimits[NUM_JOINTS] = {10.0, 10.0, 10.0, 10.0, 5.0, 5.0, 5.0};
+void MuJoCo_realRobot_ROS::publishPositions(int robotId, const double positions[]){
+    robotInterface &robot = *robotInterfaces[robotId];
+    std_msgs::Float64MultiArray &desired_positions = robot.positionMsg;
 
-    if(!haltRobot){
-        //std::cout << "torques Sent: " << torques[0] << ", " << torques[1] << ", " << torques[2] << ", " << torques[3] << ", " << torques[4] << ", " << torques[5] << ", " << torques[6] << ", " << std::endl;
+    if(!robot.safetyMonitor.isHalted()){
         for(int i = 0; i < NUM_JOINTS; i++){
-
-            if(jointSpeeds[i] > jointSpeedLimits[i]){
-                std::cout << "safety vel triggered" << std::endl;
-                std::cout << "joint " << i <<  " speed: " << jointSpeeds[i] << std::endl;
-                std::cout << "joints at safety trigger: " << jointVals[i] << std::endl;
-                haltRobot = true;
-            }
-
-            if(jointSpeeds[i] < -jointSpeedLimits[i]){
-                std::cout << "safety vel triggered" << std::endl;
-                std::cout << "joint " << i <<  " speed: " << jointSpeeds[i] << std::endl;
-                std::cout << "joints at safety trigger: " << jointVals[i] << std::endl;
-                haltRobot = true;
-            }
-
-            desired_positions.data.push_back(positions[i]);
-
+            desired_positions.data[i] = positions[i];
         }
-        position_pub->publish(desired_positions);
+        commandLogger.log(LOG_POSITION_COMMAND, -1, positions, NUM_JOINTS, robotId);
+        robot.position_pub.publish(desired_positions);
     }
     else{
         // dont publish anything
 
     }
-
-    ros::spinOnce();
 }
 
-void MuJoCo_realRobot_ROS::sendVelocitiesToRealRobot(double velocities[]){
-    std_msgs::Float64MultiArray  desired_velocities;
-    double jointSpeedLimits[NUM_JOINTS] = {0.7, 0.7, 0.7, 0.7, 1.5, 1.5, 1.5};
+void MuJoCo_realRobot_ROS::publishVelocities(int robotId, const double velocities[]){
+    robotInterface &robot = *robotInterfaces[robotId];
+    std_msgs::Float64MultiArray &desired_velocities = robot.velocityMsg;
 
-    if(!haltRobot){
-        //std::cout << "torques Sent: " << torques[0] << ", " << torques[1] << ", " << torques[2] << ", " << torques[3] << ", " << torques[4] << ", " << torques[5] << ", " << torques[6] << ", " << std::endl;
+    if(!robot.safetyMonitor.isHalted()){
         for(int i = 0; i < NUM_JOINTS; i++){
-
-            if(jointSpeeds[i] > jointSpeedLimits[i]){
-                std::cout << "safety vel triggered" << std::endl;
-                std::cout << "joint " << i <<  " speed: " << jointSpeeds[i] << std::endl;
-                std::cout << "joints at safety trigger: " << jointVals[i] << std::endl;
-                haltRobot = true;
-            }
-
-            if(jointSpeeds[i] < -jointSpeedLimits[i]){
-                std::cout << "safety vel triggered" << std::endl;
-                std::cout << "joint " << i <<  " speed: " << jointSpeeds[i] << std::endl;
-                std::cout << "joints at safety trigger: " << jointVals[i] << std::endl;
-                haltRobot = true;
-            }
-
-            desired_velocities.data.push_back(velocities[i]);
-
+            desired_velocities.data[i] = velocities[i];
         }
-        velocity_pub->publish(desired_velocities);
+        commandLogger.log(LOG_VELOCITY_COMMAND, -1, velocities, NUM_JOINTS, robotId);
+        robot.velocity_pub.publish(desired_velocities);
     }
     else{
         // dont publish anything
 
     }
+}
+
+bool MuJoCo_realRobot_ROS::isHalted(){
+    for(int i = 0; i < robotInterfaces.size(); i++){
+        if(robotInterfaces[i]->safetyMonitor.isHalted()){
+            return true;
+        }
+    }
+    return false;
+}
 
-    ros::spinOnce();
+bool MuJoCo_realRobot_ROS::isHalted(int robotId){
+    return robotInterfaces[robotId]->safetyMonitor.isHalted();
 }
 
-// void MuJoCo_realRobot_ROS::resetTorqueControl(){
-//     haltRobot = false;
-// }
+safetyEvent MuJoCo_realRobot_ROS::getSafetyEvent(int robotId){
+    return robotInterfaces[robotId]->safetyMonitor.lastEvent();
+}
+
+void MuJoCo_realRobot_ROS::resetTorqueControl(){
+    for(int i = 0; i < robotInterfaces.size(); i++){
+        robotInterfaces[i]->safetyMonitor.reset();
+    }
+}
@@ -0,0 +1,150 @@
+#include "OffscreenGL.h"
+
+#include <iostream>
+#include <vector>
+
+#if !defined(MUJOCO_GL_OSMESA)
+#include <GLFW/glfw3.h>
+
+static GLFWwindow *hiddenWindow = NULL;
+
+static bool createHiddenWindow(int width, int height){
+    if(!glfwInit()){
+        std::cout << "could not initialise GLFW" << std::endl;
+        return false;
+    }
+
+    glfwWindowHint(GLFW_VISIBLE, 0);
+    hiddenWindow = glfwCreateWindow(width, height, "offscreen", NULL, NULL);
+    if(!hiddenWindow){
+        std::cout << "could not create a hidden GLFW window, is there a display?" << std::endl;
+        return false;
+    }
+    glfwMakeContextCurrent(hiddenWindow);
+    return true;
+}
+
+static void destroyHiddenWindow(){
+    if(hiddenWindow){
+        glfwDestroyWindow(hiddenWindow);
+        glfwTerminate();
+    }
+    hiddenWindow = NULL;
+}
+#endif
+
+#if defined(MUJOCO_GL_EGL)
+#include <EGL/egl.h>
+
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+static EGLContext eglContext = EGL_NO_CONTEXT;
+
+static bool createEGLContext(){
+    eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if(eglDisplay == EGL_NO_DISPLAY || eglInitialize(eglDisplay, NULL, NULL) != EGL_TRUE){
+        std::cout << "could not initialise EGL, error " << eglGetError() << std::endl;
+        return false;
+    }
+
+    const EGLint configAttributes[] = {
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_STENCIL_SIZE, 8,
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if(eglChooseConfig(eglDisplay, configAttributes, &config, 1, &numConfigs) != EGL_TRUE || numConfigs < 1){
+        std::cout << "no suitable EGL config, error " << eglGetError() << std::endl;
+        return false;
+    }
+
+    eglBindAPI(EGL_OPENGL_API);
+    eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, NULL);
+    if(eglContext == EGL_NO_CONTEXT){
+        std::cout << "could not create EGL context, error " << eglGetError() << std::endl;
+        return false;
+    }
+
+    // Surfaceless, everything is drawn into MuJoCo's offscreen framebuffer
+    if(eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext) != EGL_TRUE){
+        std::cout << "could not make EGL context current, error " << eglGetError() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static void destroyEGLContext(){
+    if(eglDisplay != EGL_NO_DISPLAY){
+        eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if(eglContext != EGL_NO_CONTEXT){
+            eglDestroyContext(eglDisplay, eglContext);
+        }
+        eglTerminate(eglDisplay);
+    }
+    eglDisplay = EGL_NO_DISPLAY;
+    eglContext = EGL_NO_CONTEXT;
+}
+
+bool createOffscreenGLContext(int width, int height){
+    if(createEGLContext()){
+        return true;
+    }
+    destroyEGLContext();
+
+    // A machine with a display but no usable EGL can still render through a hidden window
+    std::cout << "EGL is not available, trying a hidden GLFW window" << std::endl;
+    return createHiddenWindow(width, height);
+}
+
+void destroyOffscreenGLContext(){
+    destroyEGLContext();
+    destroyHiddenWindow();
+}
+
+#elif defined(MUJOCO_GL_OSMESA)
+#include <GL/osmesa.h>
+
+static OSMesaContext osmesaContext = NULL;
+// OSMesa needs a buffer to make the context current, even though MuJoCo never draws into it
+static std::vector<unsigned char> osmesaBuffer;
+
+bool createOffscreenGLContext(int width, int height){
+    osmesaContext = OSMesaCreateContextExt(OSMESA_RGBA, 24, 8, 8, NULL);
+    if(!osmesaContext){
+        std::cout << "could not create OSMesa context" << std::endl;
+        return false;
+    }
+
+    osmesaBuffer.resize(width * height * 4);
+    if(!OSMesaMakeCurrent(osmesaContext, osmesaBuffer.data(), GL_UNSIGNED_BYTE, width, height)){
+        std::cout << "could not make OSMesa context current" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void destroyOffscreenGLContext(){
+    if(osmesaContext){
+        OSMesaDestroyContext(osmesaContext);
+    }
+    osmesaContext = NULL;
+    osmesaBuffer.clear();
+}
+
+#else
+
+bool createOffscreenGLContext(int width, int height){
+    return createHiddenWindow(width, height);
+}
+
+void destroyOffscreenGLContext(){
+    destroyHiddenWindow();
+}
+
+#endif
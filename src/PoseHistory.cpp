@@ -0,0 +1,141 @@
+#include "PoseHistory.h"
+
+// Poses closer together than this are treated as the same instant, no velocity from them
+#define MIN_VELOCITY_DT     1e-6
+
+PoseHistory::PoseHistory(int capacity) : capacity(capacity){
+    slots = std::unique_ptr<SeqLock<stampedPose>[]>(new SeqLock<stampedPose>[capacity]);
+    written = 0;
+}
+
+void PoseHistory::add(const double pose[7], const ros::Time &stamp){
+    const uint64_t index = written.load(std::memory_order_relaxed);
+
+    stampedPose entry;
+    for(int i = 0; i < 7; i++){
+        entry.pose[i] = pose[i];
+    }
+    entry.stamp = stamp;
+    entry.index = index;
+    slots[index % capacity].write(entry);
+
+    written.store(index + 1, std::memory_order_release);
+}
+
+bool PoseHistory::readEntry(uint64_t index, stampedPose &entry) const{
+    entry = slots[index % capacity].read();
+    return entry.index == index;
+}
+
+bool PoseHistory::latest(stampedPose &out) const{
+    const uint64_t total = count();
+    if(total == 0){
+        return false;
+    }
+
+    // The writer can lap a slow reader, just retry with the new newest entry
+    while(!readEntry(count() - 1, out)){
+    }
+    return true;
+}
+
+bool PoseHistory::poseAt(const ros::Time &t, double pose[7]) const{
+    ros::Time sampleTime;
+    return sampleAt(t, pose, sampleTime);
+}
+
+bool PoseHistory::sampleAt(const ros::Time &t, double pose[7], ros::Time &sampleTime) const{
+    stampedPose newer;
+    if(!latest(newer)){
+        return false;
+    }
+
+    if(t >= newer.stamp){
+        for(int i = 0; i < 7; i++){
+            pose[i] = newer.pose[i];
+        }
+        sampleTime = newer.stamp;
+        return true;
+    }
+
+    // Walk backwards until the first pose at or before t
+    stampedPose older;
+    const uint64_t oldestHeld = newer.index + 1 > (uint64_t)capacity ? newer.index + 1 - capacity : 0;
+    for(uint64_t index = newer.index; index-- > oldestHeld;){
+        if(!readEntry(index, older)){
+            // overwritten while searching, the oldest pose we managed to read will have to do
+            break;
+        }
+
+        if(older.stamp <= t){
+            const double span = (newer.stamp - older.stamp).toSec();
+            const double alpha = span > 0.0 ? (t - older.stamp).toSec() / span : 1.0;
+            interpolatePose(older.pose, newer.pose, alpha, pose);
+            sampleTime = span > 0.0 ? t : newer.stamp;
+            return true;
+        }
+        newer = older;
+    }
+
+    for(int i = 0; i < 7; i++){
+        pose[i] = newer.pose[i];
+    }
+    sampleTime = newer.stamp;
+    return true;
+}
+
+bool PoseHistory::velocityAt(const ros::Time &t, double window_s, double linear[3], double angular[3]) const{
+    stampedPose newest;
+    if(count() < 2 || !latest(newest)){
+        return false;
+    }
+
+    const ros::Time end = t.isZero() ? newest.stamp : t;
+    const ros::Time start = end - ros::Duration(window_s);
+
+    // Either end may have been clamped, with a short history or t after the newest pose
+    double endPose[7];
+    double startPose[7];
+    ros::Time endTime, startTime;
+    sampleAt(end, endPose, endTime);
+    sampleAt(start, startPose, startTime);
+    const double dt = (endTime - startTime).toSec();
+    if(dt < MIN_VELOCITY_DT){
+        return false;
+    }
+
+    for(int i = 0; i < 3; i++){
+        linear[i] = (endPose[i] - startPose[i]) / dt;
+    }
+
+    // Rotation taking the start orientation to the end one, expressed in the world frame
+    const Eigen::Quaterniond startQuat(startPose[3], startPose[4], startPose[5], startPose[6]);
+    const Eigen::Quaterniond endQuat(endPose[3], endPose[4], endPose[5], endPose[6]);
+    Eigen::Quaterniond delta = endQuat * startQuat.conjugate();
+    if(delta.w() < 0.0){
+        // shortest way round
+        delta.coeffs() = -delta.coeffs();
+    }
+    const Eigen::AngleAxisd rotation(delta.normalized());
+    const Eigen::Vector3d omega = rotation.axis() * rotation.angle() / dt;
+    for(int i = 0; i < 3; i++){
+        angular[i] = omega(i);
+    }
+
+    return true;
+}
+
+void interpolatePose(const double from[7], const double to[7], double alpha, double result[7]){
+    for(int i = 0; i < 3; i++){
+        result[i] = from[i] + alpha * (to[i] - from[i]);
+    }
+
+    // slerp takes the shortest path, so the sign of either quaternion does not matter
+    const Eigen::Quaterniond fromQuat(from[3], from[4], from[5], from[6]);
+    const Eigen::Quaterniond toQuat(to[3], to[4], to[5], to[6]);
+    const Eigen::Quaterniond q = fromQuat.slerp(alpha, toQuat).normalized();
+    result[3] = q.w();
+    result[4] = q.x();
+    result[5] = q.y();
+    result[6] = q.z();
+}
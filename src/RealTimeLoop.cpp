@@ -0,0 +1,182 @@
+#include "RealTimeLoop.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "ros/ros.h"
+
+#define NSEC_PER_SEC        1000000000L
+// How many cycles between publishing the stats for other threads
+#define STATS_PUBLISH_CYCLES    100
+
+static void addNanoseconds(timespec &t, long nsec){
+    t.tv_nsec += nsec;
+    while(t.tv_nsec >= NSEC_PER_SEC){
+        t.tv_nsec -= NSEC_PER_SEC;
+        t.tv_sec++;
+    }
+}
+
+static double differenceMicroseconds(const timespec &later, const timespec &earlier){
+    return (later.tv_sec - earlier.tv_sec) * 1e6 + (later.tv_nsec - earlier.tv_nsec) / 1e3;
+}
+
+RealTimeLoop::RealTimeLoop(){
+    running = false;
+    loopStats = realTimeLoopStats();
+    periodSum_us = 0.0;
+    sharedStats.write(loopStats);
+}
+
+RealTimeLoop::~RealTimeLoop(){
+    stop();
+}
+
+bool RealTimeLoop::start(const realTimeLoopConfig &loopConfig, std::function<void()> cycleFunction){
+    if(running){
+        return false;
+    }
+
+    config = loopConfig;
+    cycle = cycleFunction;
+
+    periodHistogram.assign(HISTOGRAM_BINS, 0);
+    loopStats = realTimeLoopStats();
+    periodSum_us = 0.0;
+    sharedStats.write(loopStats);
+
+    if(config.lockMemory){
+        if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0){
+            ROS_WARN("real time loop: mlockall failed (%s), continuing without locked memory", std::strerror(errno));
+        }
+    }
+
+    running = true;
+    loopThread = std::thread(&RealTimeLoop::run, this);
+    return true;
+}
+
+void RealTimeLoop::stop(){
+    running = false;
+    if(loopThread.joinable()){
+        loopThread.join();
+    }
+}
+
+bool RealTimeLoop::isRunning() const{
+    return running;
+}
+
+realTimeLoopStats RealTimeLoop::getStats() const{
+    return sharedStats.read();
+}
+
+void RealTimeLoop::setupThread(){
+    if(config.cpu >= 0){
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(config.cpu, &cpuSet);
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+        if(error != 0){
+            ROS_WARN("real time loop: could not pin thread to cpu %d (%s)", config.cpu, std::strerror(error));
+        }
+    }
+
+    if(config.priority > 0){
+        sched_param param;
+        param.sched_priority = config.priority;
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if(error != 0){
+            ROS_WARN("real time loop: could not set SCHED_FIFO priority %d (%s), running with normal scheduling", config.priority, std::strerror(error));
+        }
+    }
+}
+
+void RealTimeLoop::run(){
+    setupThread();
+
+    const long period_ns = (long)(NSEC_PER_SEC / config.rate_hz);
+
+    timespec nextWakeup;
+    clock_gettime(CLOCK_MONOTONIC, &nextWakeup);
+    timespec lastWakeup = nextWakeup;
+    bool firstCycle = true;
+
+    while(running){
+        addNanoseconds(nextWakeup, period_ns);
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &nextWakeup, NULL) == EINTR){
+            // interrupted by a signal, go back to sleep until the deadline
+        }
+
+        timespec wakeup;
+        clock_gettime(CLOCK_MONOTONIC, &wakeup);
+        if(!firstCycle){
+            recordPeriod(differenceMicroseconds(wakeup, lastWakeup));
+        }
+        lastWakeup = wakeup;
+        firstCycle = false;
+
+        cycle();
+
+        // If the cycle ran past the next deadline, start counting again from now rather than
+        // trying to catch up with a burst of back to back cycles
+        timespec finished;
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        timespec nextDeadline = nextWakeup;
+        addNanoseconds(nextDeadline, period_ns);
+        if(differenceMicroseconds(finished, nextDeadline) > 0){
+            loopStats.overruns++;
+            nextWakeup = finished;
+        }
+
+        if(loopStats.cycles % STATS_PUBLISH_CYCLES == 0){
+            publishStats();
+        }
+    }
+
+    publishStats();
+}
+
+void RealTimeLoop::recordPeriod(double period_us){
+    if(loopStats.cycles == 0 || period_us < loopStats.minPeriod_us){
+        loopStats.minPeriod_us = period_us;
+    }
+    if(period_us > loopStats.maxPeriod_us){
+        loopStats.maxPeriod_us = period_us;
+    }
+    loopStats.cycles++;
+    periodSum_us += period_us;
+
+    int bin = (int)period_us;
+    if(bin < 0){
+        bin = 0;
+    }
+    if(bin >= HISTOGRAM_BINS){
+        bin = HISTOGRAM_BINS - 1;
+    }
+    periodHistogram[bin]++;
+}
+
+void RealTimeLoop::publishStats(){
+    if(loopStats.cycles > 0){
+        loopStats.meanPeriod_us = periodSum_us / loopStats.cycles;
+
+        const uint64_t p99Count = (uint64_t)std::ceil(loopStats.cycles * 0.99);
+        uint64_t count = 0;
+        for(int i = 0; i < HISTOGRAM_BINS; i++){
+            count += periodHistogram[i];
+            if(count >= p99Count){
+                // upper edge of the bin, so the reported value is never optimistic
+                loopStats.p99Period_us = i + 1;
+                break;
+            }
+        }
+    }
+
+    sharedStats.write(loopStats);
+}
@@ -0,0 +1,130 @@
+#include "SafetyMonitor.h"
+
+#include <yaml-cpp/yaml.h>
+
+SafetyMonitor::SafetyMonitor(){
+    // Zero limits fail safe, anything but standing still at q = 0 halts
+    limits.maxVelocity.setZero();
+    limits.minPosition.setZero();
+    limits.maxPosition.setZero();
+    limits.maxTorque.setZero();
+    limits.maxAcceleration.setZero();
+    limits.accelerationFilterAlpha = 1.0;
+
+    havePrevious = false;
+    previousDq.setZero();
+    filteredAcceleration.setZero();
+
+    halted = false;
+    safetyEvent noEvent = safetyEvent();
+    noEvent.reason = SAFETY_OK;
+    haltEvent.write(noEvent);
+}
+
+static bool readJointArray(const YAML::Node &config, const std::string &key, jointArray &values){
+    if(!config[key]){
+        return true;
+    }
+    if(!config[key].IsSequence() || config[key].size() != values.size()){
+        ROS_ERROR("safety limits: '%s' must be a list of %d values", key.c_str(), (int)values.size());
+        return false;
+    }
+    for(int i = 0; i < values.size(); i++){
+        values(i) = config[key][i].as<double>();
+    }
+    return true;
+}
+
+bool SafetyMonitor::loadLimits(const std::string &filePath){
+    safetyLimits loaded = limits;
+
+    try{
+        YAML::Node config = YAML::LoadFile(filePath);
+
+        bool valid = readJointArray(config, "joint_velocity_limits", loaded.maxVelocity);
+        valid &= readJointArray(config, "joint_position_lower", loaded.minPosition);
+        valid &= readJointArray(config, "joint_position_upper", loaded.maxPosition);
+        valid &= readJointArray(config, "joint_torque_limits", loaded.maxTorque);
+        valid &= readJointArray(config, "joint_acceleration_limits", loaded.maxAcceleration);
+        if(config["acceleration_filter_alpha"]){
+            loaded.accelerationFilterAlpha = config["acceleration_filter_alpha"].as<double>();
+        }
+
+        if(!valid){
+            return false;
+        }
+    }
+    catch(const YAML::Exception &e){
+        ROS_ERROR("could not load safety limits from %s: %s", filePath.c_str(), e.what());
+        return false;
+    }
+
+    if(loaded.accelerationFilterAlpha <= 0.0 || loaded.accelerationFilterAlpha > 1.0){
+        ROS_ERROR("safety limits: acceleration_filter_alpha must be in (0, 1]");
+        return false;
+    }
+
+    limits = loaded;
+    return true;
+}
+
+bool SafetyMonitor::update(const jointArray &q, const jointArray &dq, const jointArray &tau, const ros::Time &stamp){
+    if(havePrevious){
+        const double dt = (stamp - previousStamp).toSec();
+        if(dt > 0.0){
+            const jointArray acceleration = (dq - previousDq) / dt;
+            filteredAcceleration += limits.accelerationFilterAlpha * (acceleration - filteredAcceleration);
+        }
+    }
+    previousDq = dq;
+    previousStamp = stamp;
+    havePrevious = true;
+
+    if(isHalted()){
+        return false;
+    }
+
+    // How far over each limit every joint is, anything positive is a violation
+    const jointArray velocityExcess = dq.abs() - limits.maxVelocity;
+    const jointArray positionExcess = (limits.minPosition - q).max(q - limits.maxPosition);
+    const jointArray torqueExcess = tau.abs() - limits.maxTorque;
+    const jointArray accelerationExcess = filteredAcceleration.abs() - limits.maxAcceleration;
+
+    if((velocityExcess > 0.0).any()){
+        latch(SAFETY_VELOCITY, dq, velocityExcess, limits.maxVelocity, stamp);
+    }
+    else if((positionExcess > 0.0).any()){
+        latch(SAFETY_POSITION, q, positionExcess, (q < limits.minPosition).select(limits.minPosition, limits.maxPosition), stamp);
+    }
+    else if((torqueExcess > 0.0).any()){
+        latch(SAFETY_TORQUE, tau, torqueExcess, limits.maxTorque, stamp);
+    }
+    else if((accelerationExcess > 0.0).any()){
+        latch(SAFETY_ACCELERATION, filteredAcceleration, accelerationExcess, limits.maxAcceleration, stamp);
+    }
+    else{
+        return false;
+    }
+
+    return true;
+}
+
+void SafetyMonitor::latch(int reason, const jointArray &values, const jointArray &exceeded, const jointArray &limit, const ros::Time &stamp){
+    // Report the joint that is furthest over its limit
+    int joint;
+    exceeded.maxCoeff(&joint);
+
+    safetyEvent event;
+    event.reason = reason;
+    event.joint = joint;
+    event.value = values(joint);
+    event.limit = limit(joint);
+    event.stamp = stamp;
+    haltEvent.write(event);
+
+    halted.store(true, std::memory_order_release);
+}
+
+void SafetyMonitor::reset(){
+    halted.store(false, std::memory_order_release);
+}
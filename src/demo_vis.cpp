@@ -1,6 +1,17 @@
 #include "MuJoCo_node.h"
+#include "MuJoCo_binding.h"
+#include "MjDataTripleBuffer.h"
+#include "OffscreenGL.h"
+#include "FrameRecorder.h"
+#include "ModelCache.h"
 #include "mujoco.h"
 #include <GLFW/glfw3.h>
+#include <std_srvs/Trigger.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <mutex>
 
 // -----------------------------------------------------------------------------------------
 // Keyboard + mouse callbacks + variables
@@ -23,40 +34,173 @@ mjvCamera cam;                   // abstract camera
 mjvScene scn;                   // abstract scene
 mjvOption opt;			        // visualization options
 mjrContext con;				    // custom GPU context
-GLFWwindow *window;              // GLFW window
+GLFWwindow *window;              // GLFW window, NULL when headless
 // ----------------------------------------------------------------------
 
-mjModel *model;
-mjData* mdata_real;
+#define WINDOW_WIDTH        1200
+#define WINDOW_HEIGHT       900
+
+// Headless runs render offscreen (see OffscreenGL.h) and can save every frame
+bool headless = false;
+FrameRecorder *frameRecorder = NULL;
+
+// Scene to load, compiled once and then reused from the model cache until it or its assets change
+std::string modelPath = "/home/davidrussell/catkin_ws/src/realRobotExperiments_TrajOpt/MuJoCo_realRobot_ROS/mujoco_models/Franka_emika_scenes_V1/cylinder_pushing_heavyClutter_realWorld.xml";
+bool useModelCache = true;
+
+// Everything that depends on the loaded model, replaced as a whole when the model is reloaded
+struct mujocoWorld{
+    mjModel *model;
+    // Owned by the state thread, the render thread only ever sees copies of it
+    mjData *data;
+    // Completed snapshots of data, from the state thread to the render thread
+    MjDataTripleBuffer *snapshots;
+    // Where each robot joint and tracked object lives in qpos, built by the state thread
+    mujocoBindingTable bindings;
+    // Counts reloads, 0 for the model loaded at startup
+    int generation;
+};
+
+// The world each thread is currently using. After a reload the state thread moves to the new
+// world first, the render thread follows once a snapshot of it has been published and is the
+// one that frees the old world.
+mujocoWorld *stateWorld = NULL;
+mujocoWorld *renderWorld = NULL;
+// Compiled in the background, waiting for the state thread to pick it up
+std::atomic<mujocoWorld*> loadedWorld(NULL);
+// In use by the state thread, waiting for the render thread to pick it up
+std::atomic<mujocoWorld*> switchedWorld(NULL);
+// Set from the start of a reload until the render thread has switched, one reload at a time
+std::atomic<bool> reloadInProgress(false);
+int modelGeneration = 0;
+
+// Reloads are compiled on their own spinner thread, so neither drawing nor the state thread waits
+ros::CallbackQueue reloadQueue;
+ros::AsyncSpinner *reloadSpinner = NULL;
+ros::ServiceServer reloadService;
+// Optional watch on the model files, reloads when any of them is modified
+ros::Timer modelWatchTimer;
+std::filesystem::file_time_type modelFilesModified;
+
+// Brings the state data up to date with the real world at sensor rate, independent of rendering
+RealTimeLoop stateLoop;
 
 MuJoCo_realRobot_ROS* mujoco_realRobot_ROS;
+// Reused every frame so reading the real world state does not allocate
+sceneState world_real;
 
-void set_BodyPosition(mjModel *m, mjData* d, int bodyId, double position[3]);
-void set_qPosVal(mjModel *m, mjData *d, int bodyId, bool freeJoint, int freeJntAxis, double val);
-void setBodyQuat(mjModel *m, mjData *d, int bodyId, double quat[4]);
+// ----------------------------------------------------------------------
+// How the MuJoCo state is brought up to date before drawing
+enum visUpdateMode{
+    VIS_UPDATE_FULL_FORWARD,        // full mj_forward, needed if anything reads dynamics quantities
+    VIS_UPDATE_KINEMATICS           // only the stages mjv_updateScene needs (poses, com, cameras, lights)
+};
+std::atomic<visUpdateMode> visualisationUpdateMode(VIS_UPDATE_KINEMATICS);
+// Set by the keyboard callback, the state thread clears its statistics when it sees it
+std::atomic<bool> resetVisualisationStats(false);
+// Largest change in any qpos value below which the frame is considered unchanged
+double visualisationChangeTolerance = 1e-6;
+// qpos the MuJoCo state was last updated with, state thread only
+std::vector<mjtNum> lastUpdatedQpos;
+
+// State thread only. Per frame cost of updating the MuJoCo state, reported at debug level every
+// REPORT_FRAMES frames
+#define REPORT_FRAMES       1000
+double updateTimeTotal_ms = 0.0;
+int framesUpdated = 0;
+int framesSkipped = 0;
+// ----------------------------------------------------------------------
+
+// Startup phases, reported once everything is up. Times are from the start of main.
+struct startupPhase{
+    std::string name;
+    double start_ms;
+    double duration_ms;
+};
+std::chrono::steady_clock::time_point startupBegin;
+std::vector<startupPhase> startupPhases;
+// Phases run side by side and finish on different threads
+std::mutex startupPhasesMutex;
+
+void recordStartupPhase(const std::string &name, std::chrono::steady_clock::time_point start){
+    const auto end = std::chrono::steady_clock::now();
+    startupPhase phase;
+    phase.name = name;
+    phase.start_ms = std::chrono::duration<double, std::milli>(start - startupBegin).count();
+    phase.duration_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    std::lock_guard<std::mutex> lock(startupPhasesMutex);
+    startupPhases.push_back(phase);
+}
+
+void reportStartupPhases(){
+    std::lock_guard<std::mutex> lock(startupPhasesMutex);
+    std::sort(startupPhases.begin(), startupPhases.end(), [](const startupPhase &a, const startupPhase &b){
+        return a.start_ms < b.start_ms;
+    });
+
+    std::cout << "startup phases (start, duration):" << std::endl;
+    for(const startupPhase &phase : startupPhases){
+        printf("  %-26s %8.1f ms %8.1f ms\n", phase.name.c_str(), phase.start_ms, phase.duration_ms);
+    }
+    printf("  %-26s %8.1f ms\n", "total", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupBegin).count());
+}
+
+bool updateVisualisationState();
 
-void setupMujocoWorld(){
-    char error[1000];
+// Loads the model at modelPath along with everything built from it, NULL if it does not compile
+mujocoWorld* createWorld(int generation){
+    char error[1000] = "";
 
 //    model = mj_loadXML("/home/davidrussell/catkin_ws/src/realRobotExperiments_TrajOpt/Franka-emika-panda-arm/V1/cylinder_pushing.xml", NULL, error, 1000);
-    model = mj_loadXML("/home/davidrussell/catkin_ws/src/realRobotExperiments_TrajOpt/MuJoCo_realRobot_ROS/mujoco_models/Franka_emika_scenes_V1/cylinder_pushing_heavyClutter_realWorld.xml", NULL, error, 1000);
+    mjModel *model = loadModelCached(modelPath, error, 1000, useModelCache);
 
     if(!model) {
         std::cout << "model xml Error" << std::endl;
         printf("%s\n", error);
+        return NULL;
     }
 
+    if(headless){
+        // Size of MuJoCo's offscreen framebuffer, must be set before the context is made
+        model->vis.global.offwidth = WINDOW_WIDTH;
+        model->vis.global.offheight = WINDOW_HEIGHT;
+    }
+
+    mujocoWorld *world = new mujocoWorld;
+    world->model = model;
     // make data corresponding to model
-    mdata_real = mj_makeData(model);
+    world->data = mj_makeData(model);
+    world->snapshots = new MjDataTripleBuffer(model);
+    world->generation = generation;
+    return world;
+}
 
-    // init GLFW, create window, make OpenGL context current, request v-sync
-    // init GLFW
-    if (!glfwInit())
-        mju_error("Could not initialize GLFW");
+void deleteWorld(mujocoWorld *world){
+    delete world->snapshots;
+    mj_deleteData(world->data);
+    mj_deleteModel(world->model);
+    delete world;
+}
 
-    window = glfwCreateWindow(1200, 900, "iLQR_Testing", NULL, NULL);
-    glfwMakeContextCurrent(window);
-    glfwSwapInterval(1);
+// Window (or offscreen context) and OpenGL context, needs no model so it is set up while the
+// model loads. GLFW has to be used from the main thread.
+void setupWindow(){
+    if(headless){
+        window = NULL;
+        if(!createOffscreenGLContext(WINDOW_WIDTH, WINDOW_HEIGHT))
+            mju_error("Could not create an offscreen OpenGL context");
+    }
+    else{
+        // init GLFW, create window, make OpenGL context current, request v-sync
+        // init GLFW
+        if (!glfwInit())
+            mju_error("Could not initialize GLFW");
+
+        window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "iLQR_Testing", NULL, NULL);
+        glfwMakeContextCurrent(window);
+        glfwSwapInterval(1);
+    }
 
     // // initialize visualization data structures
     mjv_defaultCamera(&cam);
@@ -69,10 +213,18 @@ void setupMujocoWorld(){
     // cam.lookat[0] = 0.325;
     // cam.lookat[1] = -0.0179;
     // cam.lookat[2] = 0.258;
+}
 
+// Scene and render context for the loaded model, on the thread that owns the OpenGL context
+void setupScene(){
     // // create scene and context
-    mjv_makeScene(model, &scn, 2000);
-    mjr_makeContext(model, &con, mjFONTSCALE_150);
+    mjv_makeScene(renderWorld->model, &scn, 2000);
+    mjr_makeContext(renderWorld->model, &con, mjFONTSCALE_150);
+
+    if(headless){
+        mjr_setBuffer(mjFB_OFFSCREEN, &con);
+        return;
+    }
 
     // install GLFW mouse and keyboard callbacks
     glfwSetKeyCallback(window, keyboard);
@@ -82,32 +234,162 @@ void setupMujocoWorld(){
     glfwSetWindowCloseCallback(window, windowCloseCallback);
 }
 
-void render(){
+// Compiles modelPath again and hands it to the state thread. Runs on the reload spinner thread.
+bool reloadModel(std::string &message){
+    bool expected = false;
+    if(!reloadInProgress.compare_exchange_strong(expected, true)){
+        message = "a reload is already in progress";
+        return false;
+    }
 
-    sceneState world = mujoco_realRobot_ROS->returnScene();
+    auto startTime = std::chrono::steady_clock::now();
+    mujocoWorld *world = createWorld(modelGeneration + 1);
+    if(world == NULL){
+        reloadInProgress = false;
+        message = "could not load " + modelPath + ", keeping the current model";
+        return false;
+    }
+    modelGeneration = world->generation;
+    loadedWorld.store(world, std::memory_order_release);
+
+    message = "loaded model generation " + std::to_string(world->generation) + " in " +
+              std::to_string(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count()) + " ms";
+    std::cout << message << std::endl;
+    return true;
+}
+
+bool reloadModel_callback(std_srvs::Trigger::Request &request, std_srvs::Trigger::Response &response){
+    response.success = reloadModel(response.message);
+    return true;
+}
+
+// Newest modification time of the model and everything it includes or references
+bool modelFilesLastModified(std::filesystem::file_time_type &modified){
+    std::vector<std::string> files;
+    if(!listModelFiles(modelPath, files)){
+        return false;
+    }
+
+    std::error_code ec;
+    modified = std::filesystem::file_time_type::min();
+    for(const std::string &file : files){
+        std::filesystem::file_time_type fileModified = std::filesystem::last_write_time(file, ec);
+        if(ec){
+            return false;
+        }
+        modified = std::max(modified, fileModified);
+    }
+    return true;
+}
+
+void modelWatch_callback(const ros::TimerEvent &event){
+    std::filesystem::file_time_type modified;
+    // Files can briefly be missing while an editor saves them, try again next time
+    if(!modelFilesLastModified(modified) || modified == modelFilesModified){
+        return;
+    }
 
-    for(int i = 0; i < world.robots.size(); i++){
-        for(int j = 0; j < world.robots[i].joint_positions.size(); j++){
-            mdata_real->qpos[j] = world.robots[i].joint_positions[j];
+    std::string message;
+    if(reloadModel(message)){
+        modelFilesModified = modified;
+    }
+    else{
+        std::cout << "model changed on disk but was not reloaded, " << message << std::endl;
+        // A broken model is not retried until it is modified again
+        if(!reloadInProgress){
+            modelFilesModified = modified;
         }
     }
+}
+
+// Runs on the state thread, never waits on the window
+void stateCycle(){
+    // Switch to a reloaded model, the new data starts from qpos0 and is filled in below
+    mujocoWorld *nextWorld = loadedWorld.exchange(NULL, std::memory_order_acquire);
+    if(nextWorld != NULL){
+        stateWorld = nextWorld;
+        lastUpdatedQpos.clear();
+    }
+
+    if(resetVisualisationStats.exchange(false)){
+        lastUpdatedQpos.clear();
+        updateTimeTotal_ms = 0.0;
+        framesUpdated = 0;
+        framesSkipped = 0;
+    }
+
+    mujoco_realRobot_ROS->fillScene(world_real);
+
+    // Only needs resolving again if the tracked scene changes shape, or the model is new
+    if(nextWorld != NULL || !bindingTableMatches(stateWorld->bindings, world_real)){
+        buildBindingTable(stateWorld->model, world_real, stateWorld->bindings);
+    }
+    applyBindingTable(stateWorld->bindings, world_real, stateWorld->data);
+
+    if(updateVisualisationState()){
+        stateWorld->snapshots->publish(stateWorld->data);
+    }
+
+    // The new world has a snapshot to draw and the old one is no longer touched here
+    if(nextWorld != NULL){
+        switchedWorld.store(nextWorld, std::memory_order_release);
+    }
+}
+
+// Moves drawing over to the world the state thread switched to, between frames. The scene and
+// render context are remade for the new model, the window and camera are kept.
+void switchRenderWorld(){
+    mujocoWorld *nextWorld = switchedWorld.exchange(NULL, std::memory_order_acquire);
+    if(nextWorld == NULL){
+        return;
+    }
 
-    for(int i = 0; i < world.objects.size(); i++){
-        int bodyId = mj_name2id(model, mjOBJ_BODY, world.objects[i].name.c_str());
-        set_BodyPosition(model, mdata_real, bodyId, world.objects[i].positions);
-        setBodyQuat(model, mdata_real, bodyId, world.objects[i].quaternion);
+    mjv_freeScene(&scn);
+    mjr_freeContext(&con);
+    deleteWorld(renderWorld);
+
+    renderWorld = nextWorld;
+    mjv_makeScene(renderWorld->model, &scn, 2000);
+    mjr_makeContext(renderWorld->model, &con, mjFONTSCALE_150);
+    if(headless){
+        mjr_setBuffer(mjFB_OFFSCREEN, &con);
     }
 
-    mj_forward(model, mdata_real);
+    std::cout << "switched to model generation " << renderWorld->generation << std::endl;
+    reloadInProgress = false;
+}
+
+// Runs on the main thread, only draws the newest snapshot
+void render(){
+    switchRenderWorld();
+    const mjData *snapshot = renderWorld->snapshots->acquire();
 
     // get framebuffer viewport
     mjrRect viewport = { 0, 0, 0, 0 };
-    glfwGetFramebufferSize(window, &viewport.width, &viewport.height);
+    if(headless){
+        viewport = mjr_maxViewport(&con);
+    }
+    else{
+        glfwGetFramebufferSize(window, &viewport.width, &viewport.height);
+    }
 
-    // update scene and render
-    mjv_updateScene(model, mdata_real, &opt, NULL, &cam, mjCAT_ALL, &scn);
+    // update scene and render, the snapshot is only read
+    mjv_updateScene(renderWorld->model, const_cast<mjData*>(snapshot), &opt, NULL, &cam, mjCAT_ALL, &scn);
     mjr_render(viewport, &scn, &con);
 
+    if(headless){
+        // Read straight into a free recorder frame, skipped if the writer is behind
+        if(frameRecorder != NULL){
+            unsigned char *pixels = frameRecorder->beginFrame();
+            if(pixels != NULL){
+                mjrRect captureRect = { 0, 0, frameRecorder->getWidth(), frameRecorder->getHeight() };
+                mjr_readPixels(pixels, NULL, captureRect, &con);
+                frameRecorder->commitFrame();
+            }
+        }
+        return;
+    }
+
     // swap OpenGL buffers (blocking call due to v-sync)
     glfwSwapBuffers(window);
 
@@ -115,18 +397,220 @@ void render(){
     glfwPollEvents();
 }
 
-int main(int argc, char **argv){
+// Brings derived quantities in the state data up to date with qpos, returns false if nothing
+// has changed since the last update and the work was skipped.
+bool updateVisualisationState(){
+    auto startTime = std::chrono::steady_clock::now();
+    mjModel *model = stateWorld->model;
+    mjData *mdata_real = stateWorld->data;
+
+    bool changed = lastUpdatedQpos.size() != model->nq;
+    if(!changed){
+        for(int i = 0; i < model->nq; i++){
+            if(std::abs(mdata_real->qpos[i] - lastUpdatedQpos[i]) > visualisationChangeTolerance){
+                changed = true;
+                break;
+            }
+        }
+    }
+
+    if(changed){
+        if(visualisationUpdateMode == VIS_UPDATE_FULL_FORWARD){
+            mj_forward(model, mdata_real);
+        }
+        else{
+            // Everything mjv_updateScene reads: body, geom and site poses, subtree com for the
+            // camera and perturbations, camera and light poses and tendon paths
+            mj_kinematics(model, mdata_real);
+            mj_comPos(model, mdata_real);
+            mj_camlight(model, mdata_real);
+            if(model->ntendon > 0){
+                mj_tendon(model, mdata_real);
+            }
+        }
+        lastUpdatedQpos.assign(mdata_real->qpos, mdata_real->qpos + model->nq);
+        framesUpdated++;
+    }
+    else{
+        framesSkipped++;
+    }
+
+    updateTimeTotal_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    if(framesUpdated + framesSkipped >= REPORT_FRAMES){
+        ROS_DEBUG_STREAM("MuJoCo state update (" << (visualisationUpdateMode == VIS_UPDATE_FULL_FORWARD ? "mj_forward" : "kinematics only") << "): "
+                         << updateTimeTotal_ms / (framesUpdated + framesSkipped) << " ms per frame, "
+                         << framesUpdated << " updated, " << framesSkipped << " skipped");
+        updateTimeTotal_ms = 0.0;
+        framesUpdated = 0;
+        framesSkipped = 0;
+    }
+
+    return changed;
+}
 
-    setupMujocoWorld();
+int main(int argc, char **argv){
 
     // Create an instance of 
     // MuJoCo_realRobot_ROS mujocoController(true, &n);
     std::vector<std::string> optitrack_names = {"HotChocolate", "Bistro_1", "Bistro_2", "Bistro_3", "Bistro_4", "Bistro_5", "Bistro_6", "Bistro_7"};
+    startupBegin = std::chrono::steady_clock::now();
     mujoco_realRobot_ROS = new MuJoCo_realRobot_ROS(argc, argv, optitrack_names);
+    recordStartupPhase("ROS init", startupBegin);
+
+    // Headless mode renders offscreen, optionally saving every frame for later viewing
+    ros::NodeHandle privateNode("~");
+    std::string captureFile;
+    std::string captureFormat;
+    double captureFps;
+    privateNode.param<bool>("headless", headless, false);
+    privateNode.param<std::string>("capture_file", captureFile, "");
+    privateNode.param<std::string>("capture_format", captureFormat, "ffmpeg");
+    privateNode.param<double>("capture_fps", captureFps, 30.0);
+    privateNode.param<std::string>("model_path", modelPath, modelPath);
+    privateNode.param<bool>("model_cache", useModelCache, true);
+    double readyTimeout;
+    privateNode.param<double>("ready_timeout", readyTimeout, 10.0);
+    // Sensors and the controller switch share one deadline, the whole gate takes at most readyTimeout
+    const auto readyDeadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(readyTimeout));
+
+    // Everything below up to the first frame is independent, so it runs side by side. The model
+    // compiles, sensor data arrives and the controller switches in the background while the
+    // window and OpenGL context are created here.
+    std::future<mujocoWorld*> modelLoad = std::async(std::launch::async, [](){
+        const auto start = std::chrono::steady_clock::now();
+        mujocoWorld *world = createWorld(modelGeneration);
+        recordStartupPhase("model load", start);
+        return world;
+    });
+
+    std::future<readinessState> sensorsReady = std::async(std::launch::async, [readyDeadline](){
+        const auto start = std::chrono::steady_clock::now();
+        readinessState state;
+        mujoco_realRobot_ROS->waitUntilReady(std::chrono::duration<double>(readyDeadline - start).count(), &state);
+        recordStartupPhase("first sensor data", start);
+        return state;
+    });
+
+    std::shared_future<bool> controllerSwitched = mujoco_realRobot_ROS->switchController("effort_group_position_controller");
+    std::future<bool> controllerSwitch = std::async(std::launch::async, [controllerSwitched](){
+        const auto start = std::chrono::steady_clock::now();
+        const bool switched = controllerSwitched.get();
+        recordStartupPhase("controller switch", start);
+        return switched;
+    });
+
+    auto phaseStart = std::chrono::steady_clock::now();
+    setupWindow();
+    recordStartupPhase("window and GL context", phaseStart);
+
+    // Predict the robot forward to the time of rendering, hides the latency of the joint stream
+    mujoco_realRobot_ROS->setJointExtrapolation(true);
+    // Smooth mocap noise before it reaches the scene
+    mujoco_realRobot_ROS->enableMocapFilter(mocapFilterParams());
+
+    renderWorld = modelLoad.get();
+    if(renderWorld == NULL){
+        mju_error("Could not load the MuJoCo model");
+    }
+    stateWorld = renderWorld;
+
+    phaseStart = std::chrono::steady_clock::now();
+    setupScene();
+    recordStartupPhase("scene and render context", phaseStart);
+
+    if(headless && !captureFile.empty()){
+        frameOutputFormat format = FRAME_OUTPUT_FFMPEG;
+        if(captureFormat == "raw"){
+            format = FRAME_OUTPUT_RAW;
+        }
+        else if(captureFormat == "ppm"){
+            format = FRAME_OUTPUT_PPM;
+        }
+        else if(captureFormat != "ffmpeg"){
+            ROS_WARN("Unknown capture_format '%s', using ffmpeg", captureFormat.c_str());
+        }
+
+        mjrRect captureRect = mjr_maxViewport(&con);
+        frameRecorder = new FrameRecorder(captureRect.width, captureRect.height);
+        if(!frameRecorder->start(captureFile, format, captureFps)){
+            delete frameRecorder;
+            frameRecorder = NULL;
+        }
+    }
 
-    mujoco_realRobot_ROS->switchController("effort_group_position_controller");
+    // Optionally also track any other mocap rigid body that has a body of the same name in the model
+    bool discoverMocapBodies = false;
+    privateNode.param<bool>("discover_mocap_bodies", discoverMocapBodies, false);
+    if(discoverMocapBodies){
+        std::vector<std::string> modelBodies;
+        for(int i = 1; i < renderWorld->model->nbody; i++){
+            const char *name = mj_id2name(renderWorld->model, mjOBJ_BODY, i);
+            if(name != NULL){
+                modelBodies.push_back(name);
+            }
+        }
+        mujoco_realRobot_ROS->enableMocapDiscovery(modelBodies);
+    }
 
+    phaseStart = std::chrono::steady_clock::now();
     render();
+    recordStartupPhase("first frame", phaseStart);
+
+    // Starting values are only meaningful once the real world has been heard from, nothing is
+    // commanded or read into the scene before this
+    readinessState readiness = sensorsReady.get();
+    if(!readiness.ready()){
+        if(!readiness.jointStates){
+            ROS_WARN("No joint state received from every robot within %.1f s", readyTimeout);
+        }
+        if(!readiness.robotBase){
+            ROS_WARN("Robot base pose not known within %.1f s", readyTimeout);
+        }
+        for(const std::string &name : readiness.missingObjects){
+            ROS_WARN("Rigid body '%s' not seen within %.1f s", name.c_str(), readyTimeout);
+        }
+    }
+    if(controllerSwitch.wait_until(readyDeadline) != std::future_status::ready){
+        ROS_WARN("Controller switch still pending after %.1f s", readyTimeout);
+    }
+    else if(!controllerSwitch.get()){
+        ROS_WARN("Could not switch to effort_group_position_controller");
+    }
+    reportStartupPhases();
+
+    // Commands sent below are published at a fixed 1 kHz from their own thread. The demo only
+    // visualises, so it runs without real time priority or locking the process into memory.
+    realTimeLoopConfig commandThreadConfig;
+    commandThreadConfig.priority = 0;
+    commandThreadConfig.lockMemory = false;
+    mujoco_realRobot_ROS->startCommandThread(commandThreadConfig);
+
+    // State is brought up to date at sensor rate on its own thread, a slow or minimised window
+    // only means fewer snapshots get drawn. Until it starts the first frame shows qpos0.
+    realTimeLoopConfig stateThreadConfig;
+    stateThreadConfig.rate_hz = 1000.0;
+    stateThreadConfig.priority = 0;
+    stateThreadConfig.lockMemory = false;
+    stateLoop.start(stateThreadConfig, stateCycle);
+
+    // The model can be swapped without restarting, on request or whenever its files change
+    bool watchModel;
+    double watchModelPeriod;
+    privateNode.param<bool>("watch_model", watchModel, false);
+    privateNode.param<double>("watch_model_period", watchModelPeriod, 1.0);
+
+    ros::NodeHandle reloadNh("~");
+    reloadNh.setCallbackQueue(&reloadQueue);
+    reloadService = reloadNh.advertiseService("reload_model", reloadModel_callback);
+    if(watchModel){
+        if(!modelFilesLastModified(modelFilesModified)){
+            ROS_WARN("Could not read the model files, changes will only be picked up once they can be");
+        }
+        modelWatchTimer = reloadNh.createTimer(ros::Duration(watchModelPeriod), modelWatch_callback);
+    }
+    reloadSpinner = new ros::AsyncSpinner(1, &reloadQueue);
+    reloadSpinner->start();
+
     // Get starting robot joint values
     sceneState world = mujoco_realRobot_ROS->returnScene();
     std::vector<double> robot_joints = world.robots[0].joint_positions;
@@ -138,7 +622,10 @@ int main(int argc, char **argv){
 //
 //    robot_pos_command[0] += 0.3;
 
-    while(ros::ok()){
+    // Without a window there is no v-sync, so headless frames are paced to the capture rate
+    ros::Rate headlessRate(captureFps);
+
+    while(ros::ok() && (headless || !glfwWindowShouldClose(window))){
 
 //        counter++;
 //        if(counter < 200){
@@ -148,8 +635,50 @@ int main(int argc, char **argv){
         //mujoco_realRobot_ROS->sendPositionsToRealRobot(robot_pos_command);
 
         render();
+
+        if(headless){
+            headlessRate.sleep();
+        }
+    }
+
+    // A reload may be compiling, and the state thread uses the model and data, stop both
+    // before anything is freed
+    modelWatchTimer.stop();
+    reloadSpinner->stop();
+    delete reloadSpinner;
+    stateLoop.stop();
+
+    // Stops the command thread, logger, controller manager workers and spinners while roscpp is
+    // still up
+    delete mujoco_realRobot_ROS;
+
+    if(frameRecorder != NULL){
+        // Writes out any frames still queued
+        frameRecorder->stop();
+        if(frameRecorder->droppedFrames() > 0){
+            ROS_WARN("Frame capture dropped %llu frames", (unsigned long long)frameRecorder->droppedFrames());
+        }
+        delete frameRecorder;
     }
 
+    mjv_freeScene(&scn);
+    mjr_freeContext(&con);
+    if(headless){
+        destroyOffscreenGLContext();
+    }
+
+    // free MuJoCo model and data, deactivate. The state thread may be ahead of the render thread
+    // by one reload, and one more may still be waiting for it.
+    mujocoWorld *pendingWorld = loadedWorld.exchange(NULL);
+    if(pendingWorld != NULL){
+        deleteWorld(pendingWorld);
+    }
+    if(stateWorld != renderWorld){
+        deleteWorld(stateWorld);
+    }
+    deleteWorld(renderWorld);
+    mj_deactivate();
+
     return 0;
 }
 
@@ -161,7 +690,17 @@ int main(int argc, char **argv){
 
 // keyboard callback
 void keyboard(GLFWwindow* window, int key, int scancode, int act, int mods){
-
+    // F toggles between full mj_forward and kinematics only updates, to compare their cost. The
+    // cost is reported at debug level.
+    if(act == GLFW_PRESS && key == GLFW_KEY_F){
+        if(visualisationUpdateMode == VIS_UPDATE_FULL_FORWARD){
+            visualisationUpdateMode = VIS_UPDATE_KINEMATICS;
+        }
+        else{
+            visualisationUpdateMode = VIS_UPDATE_FULL_FORWARD;
+        }
+        resetVisualisationStats = true;
+    }
 }
 
 // mouse button callback
@@ -206,65 +745,18 @@ void mouse_move(GLFWwindow* window, double xpos, double ypos){
         action = mjMOUSE_ZOOM;
 
     // move camera
-    mjv_moveCamera(model, action, dx / height, dy / height, &scn, &cam);
+    mjv_moveCamera(renderWorld->model, action, dx / height, dy / height, &scn, &cam);
 
 }
 
 // scroll callback
 void scroll(GLFWwindow* window, double xoffset, double yoffset){
     // emulate vertical mouse motion = 5% of window height
-    mjv_moveCamera(model, mjMOUSE_ZOOM, 0, -0.05 * yoffset, &scn, &cam);
+    mjv_moveCamera(renderWorld->model, mjMOUSE_ZOOM, 0, -0.05 * yoffset, &scn, &cam);
 }
 
 void windowCloseCallback(GLFWwindow * /*window*/) {
     // Use this flag if you wish not to terminate now.
     // glfwSetWindowShouldClose(window, GLFW_FALSE);
-    mjv_freeScene(&scn);
-    mjr_freeContext(&con);
-
-    // free MuJoCo model and data, deactivate
-    mj_deleteData(mdata_real);
-    mj_deleteModel(model);
-    mj_deactivate();
-}
-
-void set_BodyPosition(mjModel* m, mjData* d, int bodyId, double position[3]){
-
-    for(int i = 0; i < 3; i++){
-        set_qPosVal(m, d, bodyId, true, i, position[i]);
-    }
-
-}
-
-void set_qPosVal(mjModel *m, mjData *d, int bodyId, bool freeJoint, int freeJntAxis, double val){
-    const int jointIndex = m->body_jntadr[bodyId];
-    const int posIndex = m->jnt_qposadr[jointIndex];
-
-    // free joint axis can be any number between 0 and 2 (x, y, z)
-    if(freeJntAxis < 0 or freeJntAxis > 3){
-        std::cout << "you have used set_qPosVal wrong!!!!!!!!!!! Freejntaxis was: " << freeJntAxis << std::endl;
-    }
-
-    if(!freeJoint){
-        // automatically return 1 val
-        d->qpos[posIndex] = val;
-
-    }
-    else{
-        // have to add on freeJntAxis to get desired x y or z component of free joint
-        d->qpos[posIndex + freeJntAxis] = val;
-    }
-
+    // Everything is freed at the end of main, once the state thread has stopped
 }
-
-void setBodyQuat(mjModel *m, mjData *d, int bodyId, double quat[4]){
-    int jointIndex = m->body_jntadr[bodyId];
-    int qposIndex = m->jnt_qposadr[jointIndex];
-
-    d->qpos[qposIndex + 3] = quat[3];
-    d->qpos[qposIndex + 4] = quat[0];
-    d->qpos[qposIndex + 5] = quat[1];
-    d->qpos[qposIndex + 6] = quat[2];
-}
-
-
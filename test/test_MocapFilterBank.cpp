@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+
+#include "MocapFilterBank.h"
+
+// Counts heap allocations on the calling thread while countAllocations is set
+static std::atomic<uint64_t> allocations(0);
+static thread_local bool countAllocations = false;
+
+void* operator new(std::size_t size){
+    if(countAllocations){
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void *p = std::malloc(size == 0 ? 1 : size);
+    if(p == NULL){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept{
+    std::free(p);
+}
+
+static void setPosition(MocapFilterBank &bank, int body, double x, double t){
+    const double pose[7] = {x, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0};
+    bank.setMeasurement(body, pose, ros::Time(t));
+}
+
+TEST(MocapFilterBank, FirstMeasurementPassesThrough){
+    MocapFilterBank bank(2, mocapFilterParams());
+    const double pose[7] = {1.0, 2.0, 3.0, 0.0, 0.0, 0.0, 2.0};
+    bank.setMeasurement(1, pose, ros::Time(1.0));
+    EXPECT_EQ(bank.update(), 1);
+
+    EXPECT_FALSE(bank.updated(0));
+    ASSERT_TRUE(bank.updated(1));
+    double filtered[7];
+    bank.filteredPose(1, filtered);
+    EXPECT_DOUBLE_EQ(filtered[0], 1.0);
+    EXPECT_DOUBLE_EQ(filtered[1], 2.0);
+    EXPECT_DOUBLE_EQ(filtered[2], 3.0);
+    // quaternions are normalised
+    EXPECT_DOUBLE_EQ(filtered[6], 1.0);
+    EXPECT_EQ(bank.measurementStamp(1), ros::Time(1.0));
+}
+
+TEST(MocapFilterBank, NothingPendingDoesNothing){
+    MocapFilterBank bank(3, mocapFilterParams());
+    EXPECT_EQ(bank.update(), 0);
+    setPosition(bank, 0, 1.0, 1.0);
+    EXPECT_EQ(bank.update(), 1);
+    EXPECT_EQ(bank.update(), 0);
+    EXPECT_FALSE(bank.updated(0));
+}
+
+TEST(MocapFilterBank, SmoothsAStep){
+    MocapFilterBank bank(1, mocapFilterParams());
+    setPosition(bank, 0, 0.0, 1.0);
+    bank.update();
+    setPosition(bank, 0, 1.0, 1.01);
+    bank.update();
+
+    double filtered[7];
+    bank.filteredPose(0, filtered);
+    EXPECT_GT(filtered[0], 0.0);
+    EXPECT_LT(filtered[0], 1.0);
+
+    // held still, it converges on the measurement
+    for(int i = 2; i < 500; i++){
+        setPosition(bank, 0, 1.0, 1.0 + 0.01 * i);
+        bank.update();
+    }
+    bank.filteredPose(0, filtered);
+    EXPECT_NEAR(filtered[0], 1.0, 1e-3);
+}
+
+TEST(MocapFilterBank, BodiesAreIndependent){
+    MocapFilterBank bank(2, mocapFilterParams());
+    setPosition(bank, 0, 0.0, 1.0);
+    setPosition(bank, 1, 5.0, 1.0);
+    EXPECT_EQ(bank.update(), 2);
+
+    setPosition(bank, 0, 1.0, 1.01);
+    EXPECT_EQ(bank.update(), 1);
+    double filtered[7];
+    bank.filteredPose(1, filtered);
+    EXPECT_DOUBLE_EQ(filtered[0], 5.0);
+}
+
+TEST(MocapFilterBank, ResizeKeepsExistingState){
+    MocapFilterBank bank(0, mocapFilterParams());
+    EXPECT_EQ(bank.size(), 0);
+    EXPECT_EQ(bank.update(), 0);
+
+    bank.resize(1);
+    setPosition(bank, 0, 0.0, 1.0);
+    bank.update();
+    setPosition(bank, 0, 1.0, 1.01);
+    bank.update();
+    double before[7];
+    bank.filteredPose(0, before);
+
+    bank.resize(3);
+    EXPECT_EQ(bank.size(), 3);
+    EXPECT_FALSE(bank.updated(2));
+    double after[7];
+    bank.filteredPose(0, after);
+    for(int i = 0; i < 7; i++){
+        EXPECT_DOUBLE_EQ(after[i], before[i]);
+    }
+
+    // a new body starts at its first measurement
+    setPosition(bank, 2, 4.0, 1.02);
+    EXPECT_EQ(bank.update(), 1);
+    bank.filteredPose(2, after);
+    EXPECT_DOUBLE_EQ(after[0], 4.0);
+
+    // shrinking is ignored
+    bank.resize(1);
+    EXPECT_EQ(bank.size(), 3);
+}
+
+TEST(MocapFilterBank, QuaternionSignFlipIsNotAveraged){
+    MocapFilterBank bank(1, mocapFilterParams());
+    const double pose[7] = {0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0};
+    bank.setMeasurement(0, pose, ros::Time(1.0));
+    bank.update();
+    // the same rotation with every component negated
+    const double flipped[7] = {0.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0};
+    bank.setMeasurement(0, flipped, ros::Time(1.01));
+    bank.update();
+
+    double filtered[7];
+    bank.filteredPose(0, filtered);
+    EXPECT_NEAR(std::abs(filtered[3]), 1.0, 1e-9);
+}
+
+TEST(MocapFilterBank, OverwrittenMeasurementsAreCounted){
+    MocapFilterBank bank(2, mocapFilterParams());
+    setPosition(bank, 0, 0.0, 1.0);
+    setPosition(bank, 1, 0.0, 1.0);
+    EXPECT_EQ(bank.dropped(), 0u);
+
+    // a second sample before the update replaces the first, the newest one is filtered
+    setPosition(bank, 0, 2.0, 1.005);
+    EXPECT_EQ(bank.dropped(), 1u);
+    EXPECT_EQ(bank.update(), 2);
+    double filtered[7];
+    bank.filteredPose(0, filtered);
+    EXPECT_DOUBLE_EQ(filtered[0], 2.0);
+    EXPECT_EQ(bank.measurementStamp(0), ros::Time(1.005));
+
+    // one sample per update drops nothing
+    setPosition(bank, 0, 2.0, 1.01);
+    bank.update();
+    EXPECT_EQ(bank.dropped(), 1u);
+}
+
+TEST(MocapFilterBank, UpdateDoesNotAllocate){
+    MocapFilterBank bank(4, mocapFilterParams());
+    for(int body = 0; body < 4; body++){
+        setPosition(bank, body, 0.0, 1.0);
+    }
+    bank.update();
+
+    allocations = 0;
+    countAllocations = true;
+    for(int i = 1; i < 100; i++){
+        for(int body = 0; body < 4; body++){
+            const double pose[7] = {0.01 * i, 0.0, 0.0, std::cos(0.01 * i), std::sin(0.01 * i), 0.0, 0.0};
+            bank.setMeasurement(body, pose, ros::Time(1.0 + 0.01 * i));
+        }
+        bank.update();
+    }
+    countAllocations = false;
+    EXPECT_EQ(allocations.load(), 0u);
+}
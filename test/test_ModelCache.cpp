@@ -0,0 +1,270 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ModelCache.h"
+
+namespace fs = std::filesystem;
+
+// Writes model files into a fresh directory under the system temp directory
+class ModelCacheTest : public ::testing::Test{
+    protected:
+        void SetUp() override{
+            dir = fs::temp_directory_path() / ("model_cache_test_" + std::to_string(getpid()) + "_" + ::testing::UnitTest::GetInstance()->current_test_info()->name());
+            fs::remove_all(dir);
+            fs::create_directories(dir);
+        }
+
+        void TearDown() override{
+            fs::remove_all(dir);
+        }
+
+        std::string writeFile(const std::string &name, const std::string &contents){
+            const fs::path path = dir / name;
+            fs::create_directories(path.parent_path());
+            std::ofstream(path) << contents;
+            return path.string();
+        }
+
+        std::string path(const std::string &name){
+            return (dir / name).lexically_normal().string();
+        }
+
+        static bool contains(const std::vector<std::string> &files, const std::string &file){
+            return std::find(files.begin(), files.end(), file) != files.end();
+        }
+
+        fs::path dir;
+};
+
+TEST_F(ModelCacheTest, ListsIncludesAndAssets){
+    writeFile("robot.xml", "<mujoco><asset><mesh file=\"link.stl\"/></asset></mujoco>");
+    const std::string model = writeFile("scene.xml",
+        "<mujoco>\n"
+        "  <compiler meshdir=\"meshes\" texturedir='textures'/>\n"
+        "  <include file=\"robot.xml\"/>\n"
+        "  <asset>\n"
+        "    <texture name='grid' file='grid.png'/>\n"
+        "    <hfield name=\"terrain\" file=\"terrain.png\"/>\n"
+        "  </asset>\n"
+        "</mujoco>\n");
+
+    std::vector<std::string> files;
+    ASSERT_TRUE(listModelFiles(model, files));
+    ASSERT_GE(files.size(), 2u);
+    // the XML files come first, in document order
+    EXPECT_EQ(files[0], model);
+    EXPECT_EQ(files[1], path("robot.xml"));
+    EXPECT_TRUE(contains(files, path("meshes/link.stl")));
+    EXPECT_TRUE(contains(files, path("textures/grid.png")));
+    EXPECT_TRUE(contains(files, path("meshes/terrain.png")));
+    EXPECT_EQ(files.size(), 5u);
+}
+
+TEST_F(ModelCacheTest, ListsEveryCubeFace){
+    const std::string model = writeFile("scene.xml",
+        "<mujoco><asset>"
+        "<texture type=\"skybox\" fileright=\"r.png\" fileleft=\"l.png\" fileup='u.png'"
+        " filedown=\"d.png\" filefront=\"f.png\" fileback='b.png'/>"
+        "</asset></mujoco>");
+
+    std::vector<std::string> files;
+    ASSERT_TRUE(listModelFiles(model, files));
+    for(const char *face : {"r.png", "l.png", "u.png", "d.png", "f.png", "b.png"}){
+        EXPECT_TRUE(contains(files, path(face))) << face;
+    }
+}
+
+TEST_F(ModelCacheTest, AssetDirAppliesToMeshesAndTextures){
+    const std::string model = writeFile("scene.xml",
+        "<mujoco><compiler assetdir=\"assets\"/>"
+        "<asset><mesh file=\"a.stl\"/><texture file=\"b.png\"/></asset></mujoco>");
+
+    std::vector<std::string> files;
+    ASSERT_TRUE(listModelFiles(model, files));
+    EXPECT_TRUE(contains(files, path("assets/a.stl")));
+    EXPECT_TRUE(contains(files, path("assets/b.png")));
+}
+
+TEST_F(ModelCacheTest, IgnoresCommentedOutFiles){
+    const std::string model = writeFile("scene.xml",
+        "<mujoco><!-- <include file=\"missing.xml\"/> <mesh file=\"old.stl\"/> -->"
+        "<asset><mesh file=\"new.stl\"/></asset></mujoco>");
+
+    std::vector<std::string> files;
+    ASSERT_TRUE(listModelFiles(model, files));
+    EXPECT_FALSE(contains(files, path("old.stl")));
+    EXPECT_TRUE(contains(files, path("new.stl")));
+}
+
+TEST_F(ModelCacheTest, MissingIncludeFails){
+    const std::string model = writeFile("scene.xml", "<mujoco><include file=\"missing.xml\"/></mujoco>");
+    std::vector<std::string> files;
+    EXPECT_FALSE(listModelFiles(model, files));
+}
+
+TEST_F(ModelCacheTest, SelfIncludeStops){
+    const std::string model = writeFile("scene.xml", "<mujoco><include file=\"scene.xml\"/></mujoco>");
+    std::vector<std::string> files;
+    EXPECT_FALSE(listModelFiles(model, files));
+}
+
+// Scanned without recursion, a huge inline mesh or comment must not exhaust the stack
+TEST_F(ModelCacheTest, LargeAttributesAndComments){
+    std::string vertices;
+    for(int i = 0; i < 200000; i++){
+        vertices += "0.1 0.2 0.3 ";
+    }
+    const std::string comment(1 << 20, 'x');
+    const std::string model = writeFile("scene.xml",
+        "<mujoco><!-- " + comment + " --><asset>"
+        "<mesh name=\"inline\" vertex=\"" + vertices + "\"/>"
+        "<mesh file=\"after.stl\"/></asset>"
+        "<keyframe><key qpos='" + vertices + "'/></keyframe></mujoco>");
+
+    std::vector<std::string> files;
+    ASSERT_TRUE(listModelFiles(model, files));
+    EXPECT_TRUE(contains(files, path("after.stl")));
+    EXPECT_EQ(files.size(), 2u);
+}
+
+// loadModelCached against a cache directory of its own
+class ModelCacheLoadTest : public ModelCacheTest{
+    protected:
+        void SetUp() override{
+            ModelCacheTest::SetUp();
+            const char *previous = std::getenv("XDG_CACHE_HOME");
+            hadXdgCache = previous != NULL;
+            if(hadXdgCache){
+                previousXdgCache = previous;
+            }
+            setenv("XDG_CACHE_HOME", (dir / "cache").c_str(), 1);
+            cacheDir = dir / "cache" / "MuJoCo_realRobot_ROS";
+
+            writeFile("part.xml", "<mujoco><worldbody><geom size=\"0.1\"/></worldbody></mujoco>");
+            writeTerrain(0.0f);
+            model = writeFile("scene.xml",
+                "<mujoco>\n"
+                "  <include file=\"part.xml\"/>\n"
+                "  <asset><hfield name=\"terrain\" file=\"terrain.bin\" size=\"1 1 0.1 0.1\"/></asset>\n"
+                "</mujoco>\n");
+        }
+
+        void TearDown() override{
+            if(hadXdgCache){
+                setenv("XDG_CACHE_HOME", previousXdgCache.c_str(), 1);
+            }
+            else{
+                unsetenv("XDG_CACHE_HOME");
+            }
+            ModelCacheTest::TearDown();
+        }
+
+        // MuJoCo's binary height field format, nrow, ncol then the elevations
+        void writeTerrain(float height){
+            std::ofstream file(dir / "terrain.bin", std::ios::binary);
+            const int32_t size[2] = {2, 2};
+            const float data[4] = {0.0f, height, 0.0f, 0.0f};
+            file.write(reinterpret_cast<const char*>(size), sizeof(size));
+            file.write(reinterpret_cast<const char*>(data), sizeof(data));
+        }
+
+        void load(){
+            char error[1000] = "";
+            mjModel *m = loadModelCached(model, error, sizeof(error));
+            ASSERT_NE(m, nullptr) << error;
+            mj_deleteModel(m);
+        }
+
+        std::vector<fs::path> cachedBinaries(){
+            std::vector<fs::path> binaries;
+            std::error_code ec;
+            for(fs::directory_iterator it(cacheDir, ec), end; !ec && it != end; it.increment(ec)){
+                if(it->path().extension() == ".mjb"){
+                    binaries.push_back(it->path());
+                }
+            }
+            return binaries;
+        }
+
+        static ino_t inode(const fs::path &path){
+            struct stat info;
+            return stat(path.c_str(), &info) == 0 ? info.st_ino : 0;
+        }
+
+        std::string model;
+        fs::path cacheDir;
+        bool hadXdgCache;
+        std::string previousXdgCache;
+};
+
+TEST_F(ModelCacheLoadTest, MissWritesAndHitReuses){
+    load();
+    std::vector<fs::path> binaries = cachedBinaries();
+    ASSERT_EQ(binaries.size(), 1u);
+    const ino_t written = inode(binaries[0]);
+
+    // A miss writes a new file and renames it over the old one, a hit leaves it in place
+    load();
+    binaries = cachedBinaries();
+    ASSERT_EQ(binaries.size(), 1u);
+    EXPECT_EQ(inode(binaries[0]), written);
+}
+
+TEST_F(ModelCacheLoadTest, EditingAnIncludeRebuilds){
+    load();
+    const std::vector<fs::path> before = cachedBinaries();
+    ASSERT_EQ(before.size(), 1u);
+
+    writeFile("part.xml", "<mujoco><worldbody><geom size=\"0.2\"/></worldbody></mujoco>");
+    load();
+    std::vector<fs::path> after = cachedBinaries();
+    EXPECT_EQ(after.size(), 2u);
+}
+
+TEST_F(ModelCacheLoadTest, EditingAnAssetRebuilds){
+    load();
+    writeTerrain(0.5f);
+    load();
+    EXPECT_EQ(cachedBinaries().size(), 2u);
+
+    // and going back finds the first binary again
+    writeTerrain(0.0f);
+    load();
+    EXPECT_EQ(cachedBinaries().size(), 2u);
+}
+
+TEST_F(ModelCacheLoadTest, UnreadableBinaryIsReplaced){
+    load();
+    const std::vector<fs::path> binaries = cachedBinaries();
+    ASSERT_EQ(binaries.size(), 1u);
+    std::ofstream(binaries[0], std::ios::trunc) << "";
+
+    load();
+    ASSERT_EQ(cachedBinaries().size(), 1u);
+    EXPECT_GT(fs::file_size(binaries[0]), 0u);
+}
+
+TEST_F(ModelCacheLoadTest, OldBinariesArePruned){
+    for(int i = 0; i < MODEL_CACHE_MAX_ENTRIES + 4; i++){
+        writeTerrain(0.01f * (i + 1));
+        load();
+    }
+    EXPECT_EQ(cachedBinaries().size(), (size_t)MODEL_CACHE_MAX_ENTRIES);
+}
+
+TEST_F(ModelCacheLoadTest, DisabledCacheWritesNothing){
+    char error[1000] = "";
+    mjModel *m = loadModelCached(model, error, sizeof(error), false);
+    ASSERT_NE(m, nullptr) << error;
+    mj_deleteModel(m);
+    EXPECT_TRUE(cachedBinaries().empty());
+}
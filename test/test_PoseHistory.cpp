@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+#include "PoseHistory.h"
+
+static void makePose(double x, double yawRad, double pose[7]){
+    pose[0] = x;
+    pose[1] = 2.0 * x;
+    pose[2] = -x;
+    // {w, x, y, z} rotation about z
+    pose[3] = std::cos(yawRad / 2.0);
+    pose[4] = 0.0;
+    pose[5] = 0.0;
+    pose[6] = std::sin(yawRad / 2.0);
+}
+
+TEST(PoseHistory, EmptyHistoryHasNoPose){
+    PoseHistory history;
+    stampedPose latest;
+    double pose[7];
+    EXPECT_FALSE(history.latest(latest));
+    EXPECT_FALSE(history.poseAt(ros::Time(1.0), pose));
+    EXPECT_EQ(history.count(), 0u);
+}
+
+TEST(PoseHistory, InterpolatesBetweenNeighbours){
+    PoseHistory history;
+    double pose[7];
+    makePose(0.0, 0.0, pose);
+    history.add(pose, ros::Time(1.0));
+    makePose(1.0, M_PI / 2.0, pose);
+    history.add(pose, ros::Time(2.0));
+
+    double result[7];
+    ASSERT_TRUE(history.poseAt(ros::Time(1.25), result));
+    EXPECT_NEAR(result[0], 0.25, 1e-9);
+    EXPECT_NEAR(result[1], 0.5, 1e-9);
+    EXPECT_NEAR(result[2], -0.25, 1e-9);
+
+    // slerp a quarter of the way through a 90 degree turn
+    double expected[7];
+    makePose(0.25, M_PI / 8.0, expected);
+    for(int i = 3; i < 7; i++){
+        EXPECT_NEAR(result[i], expected[i], 1e-9);
+    }
+}
+
+TEST(PoseHistory, ClampsOutsideTheHeldRange){
+    PoseHistory history;
+    double pose[7];
+    makePose(1.0, 0.0, pose);
+    history.add(pose, ros::Time(1.0));
+    makePose(2.0, 0.0, pose);
+    history.add(pose, ros::Time(2.0));
+
+    double result[7];
+    ASSERT_TRUE(history.poseAt(ros::Time(5.0), result));
+    EXPECT_DOUBLE_EQ(result[0], 2.0);
+    ASSERT_TRUE(history.poseAt(ros::Time(0.5), result));
+    EXPECT_DOUBLE_EQ(result[0], 1.0);
+}
+
+TEST(PoseHistory, OnlyKeepsCapacityPoses){
+    PoseHistory history(4);
+    double pose[7];
+    for(int i = 0; i < 10; i++){
+        makePose(i, 0.0, pose);
+        history.add(pose, ros::Time(1.0 + i));
+    }
+    EXPECT_EQ(history.count(), 10u);
+
+    stampedPose latest;
+    ASSERT_TRUE(history.latest(latest));
+    EXPECT_DOUBLE_EQ(latest.pose[0], 9.0);
+
+    // poses 6 to 9 are still held, anything earlier clamps to pose 6
+    double result[7];
+    ASSERT_TRUE(history.poseAt(ros::Time(7.5), result));
+    EXPECT_NEAR(result[0], 6.5, 1e-9);
+    ASSERT_TRUE(history.poseAt(ros::Time(2.0), result));
+    EXPECT_DOUBLE_EQ(result[0], 6.0);
+}
+
+TEST(PoseHistory, VelocityFromWindow){
+    PoseHistory history;
+    double pose[7];
+    // 1 m/s along x and 1 rad/s about z
+    for(int i = 0; i <= 10; i++){
+        makePose(0.1 * i, 0.1 * i, pose);
+        history.add(pose, ros::Time(1.0 + 0.1 * i));
+    }
+
+    double linear[3];
+    double angular[3];
+    ASSERT_TRUE(history.velocityAt(ros::Time(), 0.5, linear, angular));
+    EXPECT_NEAR(linear[0], 1.0, 1e-9);
+    EXPECT_NEAR(linear[1], 2.0, 1e-9);
+    EXPECT_NEAR(linear[2], -1.0, 1e-9);
+    EXPECT_NEAR(angular[0], 0.0, 1e-9);
+    EXPECT_NEAR(angular[1], 0.0, 1e-9);
+    EXPECT_NEAR(angular[2], 1.0, 1e-9);
+}
+
+TEST(PoseHistory, InterpolatePoseTakesTheShortWayRound){
+    double from[7];
+    double to[7];
+    makePose(0.0, 0.0, from);
+    makePose(0.0, M_PI / 2.0, to);
+    // same rotation, opposite sign
+    for(int i = 3; i < 7; i++){
+        to[i] = -to[i];
+    }
+
+    double result[7];
+    interpolatePose(from, to, 0.5, result);
+    double expected[7];
+    makePose(0.0, M_PI / 4.0, expected);
+    const double sign = result[3] < 0.0 ? -1.0 : 1.0;
+    for(int i = 3; i < 7; i++){
+        EXPECT_NEAR(sign * result[i], expected[i], 1e-9);
+    }
+}
+
+// Less history than the window, the velocity comes from the time actually held
+TEST(PoseHistory, VelocityFromShortHistory){
+    PoseHistory history;
+    double pose[7];
+    makePose(0.0, 0.0, pose);
+    history.add(pose, ros::Time(1.0));
+    makePose(0.01, 0.01, pose);
+    history.add(pose, ros::Time(1.01));
+
+    double linear[3];
+    double angular[3];
+    ASSERT_TRUE(history.velocityAt(ros::Time(), 0.05, linear, angular));
+    EXPECT_NEAR(linear[0], 1.0, 1e-6);
+    EXPECT_NEAR(angular[2], 1.0, 1e-6);
+}
+
+TEST(PoseHistory, VelocityAfterTheNewestPose){
+    PoseHistory history;
+    double pose[7];
+    for(int i = 0; i <= 10; i++){
+        makePose(0.01 * i, 0.01 * i, pose);
+        history.add(pose, ros::Time(1.0 + 0.01 * i));
+    }
+
+    // the end clamps to the newest pose at 1.1 s, the start is still inside the history
+    double linear[3];
+    double angular[3];
+    ASSERT_TRUE(history.velocityAt(ros::Time(1.13), 0.05, linear, angular));
+    EXPECT_NEAR(linear[0], 1.0, 1e-6);
+    EXPECT_NEAR(angular[2], 1.0, 1e-6);
+
+    // entirely after the newest pose, both ends clamp to the same instant
+    EXPECT_FALSE(history.velocityAt(ros::Time(2.0), 0.05, linear, angular));
+}
+
+TEST(PoseHistory, NoVelocityFromOneInstant){
+    PoseHistory history;
+    double pose[7];
+    makePose(0.0, 0.0, pose);
+    history.add(pose, ros::Time(1.0));
+    makePose(1.0, 0.0, pose);
+    history.add(pose, ros::Time(1.0));
+
+    double linear[3];
+    double angular[3];
+    EXPECT_FALSE(history.velocityAt(ros::Time(), 0.05, linear, angular));
+}
@@ -0,0 +1,202 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#include "SafetyMonitor.h"
+
+namespace fs = std::filesystem;
+
+// Limits kept round so each test can step just over one of them
+static const char *TEST_LIMITS =
+    "joint_velocity_limits: [1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0]\n"
+    "joint_position_lower: [-2.0, -2.0, -2.0, -2.0, -2.0, -2.0, -2.0]\n"
+    "joint_position_upper: [2.0, 2.0, 2.0, 2.0, 2.0, 2.0, 2.0]\n"
+    "joint_torque_limits: [50.0, 50.0, 50.0, 50.0, 10.0, 10.0, 10.0]\n"
+    "joint_acceleration_limits: [10.0, 10.0, 10.0, 10.0, 10.0, 10.0, 10.0]\n"
+    "acceleration_filter_alpha: 1.0\n";
+
+class SafetyMonitorTest : public ::testing::Test{
+    protected:
+        void SetUp() override{
+            dir = fs::temp_directory_path() / ("safety_monitor_test_" + std::to_string(getpid()) + "_" + ::testing::UnitTest::GetInstance()->current_test_info()->name());
+            fs::create_directories(dir);
+            q.setZero();
+            dq.setZero();
+            tau.setZero();
+        }
+
+        void TearDown() override{
+            fs::remove_all(dir);
+        }
+
+        std::string writeLimits(const std::string &contents){
+            const fs::path path = dir / "limits.yaml";
+            std::ofstream(path) << contents;
+            return path.string();
+        }
+
+        void loadTestLimits(){
+            ASSERT_TRUE(monitor.loadLimits(writeLimits(TEST_LIMITS)));
+        }
+
+        bool step(double t){
+            return monitor.update(q, dq, tau, ros::Time(t));
+        }
+
+        SafetyMonitor monitor;
+        jointArray q, dq, tau;
+        fs::path dir;
+};
+
+TEST_F(SafetyMonitorTest, WithinLimitsDoesNotHalt){
+    loadTestLimits();
+    q.setConstant(1.5);
+    dq.setConstant(0.5);
+    tau.setConstant(5.0);
+    EXPECT_FALSE(step(1.0));
+    EXPECT_FALSE(step(1.001));
+    EXPECT_FALSE(monitor.isHalted());
+    EXPECT_EQ(monitor.lastEvent().reason, SAFETY_OK);
+}
+
+TEST_F(SafetyMonitorTest, VelocityTrips){
+    loadTestLimits();
+    EXPECT_FALSE(step(1.0));
+    // reached over a whole second, so the acceleration stays within its limit
+    dq(2) = -1.2;
+    EXPECT_TRUE(step(2.0));
+
+    const safetyEvent event = monitor.lastEvent();
+    EXPECT_EQ(event.reason, SAFETY_VELOCITY);
+    EXPECT_EQ(event.joint, 2);
+    EXPECT_DOUBLE_EQ(event.value, -1.2);
+    EXPECT_DOUBLE_EQ(event.limit, 1.0);
+}
+
+TEST_F(SafetyMonitorTest, PositionTripsOnEitherSide){
+    loadTestLimits();
+    q(4) = 2.1;
+    EXPECT_TRUE(step(1.0));
+    safetyEvent event = monitor.lastEvent();
+    EXPECT_EQ(event.reason, SAFETY_POSITION);
+    EXPECT_EQ(event.joint, 4);
+    EXPECT_DOUBLE_EQ(event.limit, 2.0);
+
+    monitor.reset();
+    q(4) = 0.0;
+    q(1) = -2.5;
+    EXPECT_TRUE(step(1.001));
+    event = monitor.lastEvent();
+    EXPECT_EQ(event.reason, SAFETY_POSITION);
+    EXPECT_EQ(event.joint, 1);
+    EXPECT_DOUBLE_EQ(event.value, -2.5);
+    EXPECT_DOUBLE_EQ(event.limit, -2.0);
+}
+
+TEST_F(SafetyMonitorTest, TorqueTrips){
+    loadTestLimits();
+    // under the shoulder limit, over the wrist one
+    tau(0) = 40.0;
+    tau(6) = -11.0;
+    EXPECT_TRUE(step(1.0));
+    const safetyEvent event = monitor.lastEvent();
+    EXPECT_EQ(event.reason, SAFETY_TORQUE);
+    EXPECT_EQ(event.joint, 6);
+    EXPECT_DOUBLE_EQ(event.value, -11.0);
+    EXPECT_DOUBLE_EQ(event.limit, 10.0);
+}
+
+TEST_F(SafetyMonitorTest, AccelerationTrips){
+    loadTestLimits();
+    EXPECT_FALSE(step(1.0));
+    // 0.5 rad/s in 10 ms is 50 rad/s^2, well within the velocity limit
+    dq(3) = 0.5;
+    EXPECT_TRUE(step(1.01));
+    const safetyEvent event = monitor.lastEvent();
+    EXPECT_EQ(event.reason, SAFETY_ACCELERATION);
+    EXPECT_EQ(event.joint, 3);
+    EXPECT_NEAR(event.value, 50.0, 1e-6);
+    EXPECT_DOUBLE_EQ(event.limit, 10.0);
+}
+
+TEST_F(SafetyMonitorTest, HaltLatchesUntilReset){
+    loadTestLimits();
+    q(0) = 3.0;
+    EXPECT_TRUE(step(1.0));
+    EXPECT_TRUE(monitor.isHalted());
+
+    // back within limits, and a different violation, neither changes the latched event
+    q(0) = 0.0;
+    EXPECT_FALSE(step(1.001));
+    tau(0) = 100.0;
+    EXPECT_FALSE(step(1.002));
+    EXPECT_TRUE(monitor.isHalted());
+    EXPECT_EQ(monitor.lastEvent().reason, SAFETY_POSITION);
+    EXPECT_EQ(monitor.lastEvent().stamp, ros::Time(1.0));
+
+    monitor.reset();
+    EXPECT_FALSE(monitor.isHalted());
+    tau(0) = 0.0;
+    EXPECT_FALSE(step(1.003));
+}
+
+TEST_F(SafetyMonitorTest, EventCarriesTheStampOfTheViolatingState){
+    loadTestLimits();
+    EXPECT_FALSE(step(5.0));
+    EXPECT_FALSE(step(5.001));
+    tau(1) = 60.0;
+    EXPECT_TRUE(monitor.update(q, dq, tau, ros::Time(5.002)));
+    EXPECT_EQ(monitor.lastEvent().stamp, ros::Time(5.002));
+}
+
+TEST_F(SafetyMonitorTest, NoLimitsLoadedHaltsOnMotion){
+    // nothing loaded, standing still at zero is the only safe state
+    EXPECT_FALSE(step(1.0));
+    dq(0) = 0.01;
+    EXPECT_TRUE(step(1.001));
+    EXPECT_EQ(monitor.lastEvent().reason, SAFETY_VELOCITY);
+}
+
+TEST_F(SafetyMonitorTest, MissingFileFailsSafe){
+    EXPECT_FALSE(monitor.loadLimits((dir / "missing.yaml").string()));
+    EXPECT_TRUE((monitor.getLimits().maxVelocity == 0.0).all());
+    q(0) = 0.1;
+    EXPECT_TRUE(step(1.0));
+}
+
+TEST_F(SafetyMonitorTest, PartialFileKeepsOtherLimitsClosed){
+    ASSERT_TRUE(monitor.loadLimits(writeLimits("joint_velocity_limits: [1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0]\n")));
+    EXPECT_DOUBLE_EQ(monitor.getLimits().maxVelocity(0), 1.0);
+    // position limits were never given, so any position away from zero halts
+    q(5) = 0.2;
+    EXPECT_TRUE(step(1.0));
+    EXPECT_EQ(monitor.lastEvent().reason, SAFETY_POSITION);
+}
+
+TEST_F(SafetyMonitorTest, PartialFileOverridesLoadedLimits){
+    loadTestLimits();
+    ASSERT_TRUE(monitor.loadLimits(writeLimits("joint_torque_limits: [5.0, 5.0, 5.0, 5.0, 5.0, 5.0, 5.0]\n")));
+    EXPECT_DOUBLE_EQ(monitor.getLimits().maxTorque(0), 5.0);
+    EXPECT_DOUBLE_EQ(monitor.getLimits().maxVelocity(0), 1.0);
+}
+
+TEST_F(SafetyMonitorTest, InvalidFileKeepsCurrentLimits){
+    loadTestLimits();
+    EXPECT_FALSE(monitor.loadLimits(writeLimits("joint_velocity_limits: [5.0, 5.0]\n")));
+    EXPECT_FALSE(monitor.loadLimits(writeLimits("acceleration_filter_alpha: 0.0\n")));
+    EXPECT_FALSE(monitor.loadLimits(writeLimits("joint_velocity_limits: [\n")));
+    EXPECT_DOUBLE_EQ(monitor.getLimits().maxVelocity(0), 1.0);
+    EXPECT_DOUBLE_EQ(monitor.getLimits().accelerationFilterAlpha, 1.0);
+}
+
+TEST_F(SafetyMonitorTest, ShippedLimitsLoad){
+    ASSERT_TRUE(monitor.loadLimits(TEST_CONFIG_DIR "/safety_limits.yaml"));
+    const safetyLimits &limits = monitor.getLimits();
+    EXPECT_TRUE((limits.maxVelocity > 0.0).all());
+    EXPECT_TRUE((limits.maxTorque > 0.0).all());
+    EXPECT_TRUE((limits.maxAcceleration > 0.0).all());
+    EXPECT_TRUE((limits.minPosition < limits.maxPosition).all());
+}
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "SeqLock.h"
+
+struct testPayload{
+    double values[9];
+    uint64_t counter;
+};
+
+TEST(SeqLock, ReadsWhatWasWritten){
+    SeqLock<testPayload> lock;
+    EXPECT_EQ(lock.version(), 0u);
+
+    testPayload written;
+    for(int i = 0; i < 9; i++){
+        written.values[i] = i * 0.5;
+    }
+    written.counter = 42;
+    lock.write(written);
+
+    const testPayload read = lock.read();
+    for(int i = 0; i < 9; i++){
+        EXPECT_EQ(read.values[i], written.values[i]);
+    }
+    EXPECT_EQ(read.counter, 42u);
+    EXPECT_EQ(lock.version(), 1u);
+}
+
+TEST(SeqLock, InitialValueCountsAsOneWrite){
+    testPayload initial = testPayload();
+    initial.counter = 7;
+    SeqLock<testPayload> lock(initial);
+    EXPECT_EQ(lock.read().counter, 7u);
+    EXPECT_EQ(lock.version(), 1u);
+}
+
+// Every field of a write holds the same value, a reader seeing two different values got a torn read
+TEST(SeqLock, NoTornReadsUnderContention){
+    SeqLock<testPayload> lock;
+    std::atomic<bool> running(true);
+    std::atomic<uint64_t> torn(0);
+    std::atomic<uint64_t> reads(0);
+
+    std::vector<std::thread> readers;
+    for(int r = 0; r < 3; r++){
+        readers.emplace_back([&](){
+            uint64_t lastCounter = 0;
+            while(running.load(std::memory_order_relaxed)){
+                const testPayload value = lock.read();
+                for(int i = 0; i < 9; i++){
+                    if(value.values[i] != (double)value.counter){
+                        torn++;
+                    }
+                }
+                // a single writer only ever moves forwards
+                if(value.counter < lastCounter){
+                    torn++;
+                }
+                lastCounter = value.counter;
+                reads++;
+            }
+        });
+    }
+
+    testPayload value;
+    for(uint64_t n = 1; n <= 200000; n++){
+        for(int i = 0; i < 9; i++){
+            value.values[i] = (double)n;
+        }
+        value.counter = n;
+        lock.write(value);
+    }
+    running = false;
+    for(std::thread &reader : readers){
+        reader.join();
+    }
+
+    EXPECT_GT(reads.load(), 0u);
+    EXPECT_EQ(torn.load(), 0u);
+    EXPECT_EQ(lock.version(), 200000u);
+}